@@ -1,13 +1,37 @@
-// main.cpp (GBA retro filter + 4-section Windows threading for dithering)
+// main.cpp (GBA retro filter + persistent worker pool for dithering)
 // Based on your working code :contentReference[oaicite:0]{index=0}
-// Build example (MinGW):
-//   g++ -O2 -std=c++17 main.cpp -o OpenCVExample `pkg-config --cflags --libs opencv4`
+// Build example (MinGW / Linux):
+//   g++ -O2 -std=c++17 -pthread main.cpp -o OpenCVExample `pkg-config --cflags --libs opencv4`
 
+#ifdef RETRO_HEADLESS
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#else
 #include <opencv2/opencv.hpp>
+#endif
+#include <opencv2/core/hal/intrin.hpp>
 #include <iostream>
 #include <vector>
 #include <cmath>
-#include <windows.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+namespace fs = std::filesystem;
 
 static const int BAYER8[8][8] = {
     { 0, 48, 12, 60,  3, 51, 15, 63},
@@ -25,89 +49,264 @@ static inline uchar clampU8(int v) {
 }
 
 // ------------------------------------------------------------
-// 4-section Windows threading for Ordered Dithering
+// Persistent worker pool
 // ------------------------------------------------------------
-struct DitherTask {
-    cv::Mat* img;     // CV_8UC3
-    int strength;
-    int x0, x1;       // [x0, x1)
-    int y0, y1;       // [y0, y1)
+// Threads are started once and reused for every call, so dithering
+// costs a queue push per band instead of a thread spawn. parallelFor()
+// also runs bands on the calling thread, which means the work still
+// completes (serially) if no worker thread could be created.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) {
+            try {
+                workers.emplace_back([this] { workerLoop(); });
+            } catch (const std::system_error& e) {
+                std::cerr << "Failed to create worker thread " << i << ": " << e.what() << "\n";
+                break;
+            }
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cvTask.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size(); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tasks.push_back(std::move(task));
+        }
+        cvTask.notify_one();
+    }
+
+    // Runs body(i) for every i in [0, count) and returns when all are done.
+    // Job state is shared with the helpers, so a helper that is dequeued
+    // after the caller returned only sees an exhausted counter.
+    void parallelFor(int count, const std::function<void(int)>& body) {
+        if (count <= 0) return;
+
+        struct Job {
+            const std::function<void(int)>* body = nullptr;
+            int count = 0;
+            std::atomic<int> next{0};
+            std::atomic<int> done{0};
+            std::mutex m;
+            std::condition_variable cv;
+        };
+
+        auto job = std::make_shared<Job>();
+        job->body = &body;
+        job->count = count;
+
+        auto run = [](Job& j) {
+            int i;
+            while ((i = j.next.fetch_add(1)) < j.count) {
+                (*j.body)(i);
+                if (j.done.fetch_add(1) + 1 == j.count) {
+                    std::lock_guard<std::mutex> lock(j.m);
+                    j.cv.notify_all();
+                }
+            }
+        };
+
+        const int helpers = std::min(count - 1, size());
+        for (int h = 0; h < helpers; ++h) {
+            submit([job, run] { run(*job); });
+        }
+        run(*job);
+
+        std::unique_lock<std::mutex> lock(job->m);
+        job->cv.wait(lock, [&] { return job->done.load() == job->count; });
+    }
+
+private:
+    void workerLoop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cvTask.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable cvTask;
+    bool stopping = false;
 };
 
-DWORD WINAPI DitherWorker(LPVOID param) {
-    DitherTask* t = reinterpret_cast<DitherTask*>(param);
-    cv::Mat& out = *(t->img);
+// One pool for the whole process; the caller of parallelFor() is the
+// extra thread, so hardware_concurrency() bands keep every core busy.
+static ThreadPool& workerPool() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
 
-    const int h = out.rows;
-    const int w = out.cols;
+// ------------------------------------------------------------
+// Row-band threading for Ordered Dithering
+// ------------------------------------------------------------
+// The Bayer offset only depends on (x & 7, y & 7) and strength, so the 8
+// row phases are expanded once per call into full-width interleaved BGR
+// rows. A signed offset is stored as a (plus, minus) pair of u8 rows:
+// sat_sub(sat_add(p, plus), minus) == clampU8(p + offset) for every p,
+// which keeps the vector kernel bit-exact with the scalar loop.
+struct DitherRows {
+    int width = 0;
+    std::vector<uchar> plus, minus;   // 8 rows of width * 3 bytes each
 
-    const int startY = std::max(0, t->y0);
-    const int endY   = std::min(h, t->y1);
-    const int startX = std::max(0, t->x0);
-    const int endX   = std::min(w, t->x1);
+    void build(int strength, int w) {
+        width = w;
+        plus.assign(size_t(8) * w * 3, 0);
+        minus.assign(size_t(8) * w * 3, 0);
 
-    for (int y = startY; y < endY; ++y) {
-        const int by = y & 7;
-        for (int x = startX; x < endX; ++x) {
-            const int bx = x & 7;
-            const int tval = BAYER8[by][bx]; // 0..63
+        for (int by = 0; by < 8; ++by) {
+            uchar* pr = plus.data() + size_t(by) * w * 3;
+            uchar* mr = minus.data() + size_t(by) * w * 3;
+            for (int x = 0; x < w; ++x) {
+                const int tval = BAYER8[by][x & 7]; // 0..63
 
-            const float norm = (float(tval) - 31.5f) / 63.0f;
-            const int offset = (int)std::lround(norm * float(t->strength));
+                const float norm = (float(tval) - 31.5f) / 63.0f;
+                const int offset = (int)std::lround(norm * float(strength));
 
-            cv::Vec3b& p = out.at<cv::Vec3b>(y, x);
-            p[0] = clampU8(int(p[0]) + offset);
-            p[1] = clampU8(int(p[1]) + offset);
-            p[2] = clampU8(int(p[2]) + offset);
+                for (int c = 0; c < 3; ++c) {
+                    pr[x * 3 + c] = clampU8(offset);
+                    mr[x * 3 + c] = clampU8(-offset);
+                }
+            }
         }
     }
-    return 0;
+
+    const uchar* plusRow(int y) const  { return plus.data()  + size_t(y & 7) * width * 3; }
+    const uchar* minusRow(int y) const { return minus.data() + size_t(y & 7) * width * 3; }
+};
+
+// dst[i] = clampU8(src[i] + offset[i]) for n bytes, vectorised with
+// OpenCV universal intrinsics (whatever the compiler targets, SSE2 at least)
+static void ditherRow(const uchar* src, uchar* dst, const uchar* plus, const uchar* minus, int n) {
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step = cv::VTraits<cv::v_uint8>::vlanes();
+    for (; i <= n - step; i += step) {
+        cv::v_uint8 v = cv::vx_load(src + i);
+        v = cv::v_sub(cv::v_add(v, cv::vx_load(plus + i)), cv::vx_load(minus + i));
+        cv::v_store(dst + i, v);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = clampU8(int(src[i]) + int(plus[i]) - int(minus[i]));
+    }
 }
 
-// Threaded version: divides image into 4 quadrants
+struct DitherTask {
+    const cv::Mat* src;     // CV_8UC3
+    cv::Mat* dst;           // CV_8UC3, same size
+    const DitherRows* rows;
+    int y0, y1;             // [y0, y1)
+};
+
+void DitherWorker(const DitherTask& t) {
+    const int h = t.src->rows;
+    const int n = t.src->cols * 3;
+
+    const int startY = std::max(0, t.y0);
+    const int endY   = std::min(h, t.y1);
+
+    for (int y = startY; y < endY; ++y) {
+        ditherRow(t.src->ptr<uchar>(y), t.dst->ptr<uchar>(y), t.rows->plusRow(y), t.rows->minusRow(y), n);
+    }
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    cv::vx_cleanup();
+#endif
+}
+
+// Threaded version: one row band per pool thread (plus the caller)
 cv::Mat applyOrderedDither(const cv::Mat& bgr, int strength) {
     CV_Assert(bgr.type() == CV_8UC3);
     if (strength <= 0) return bgr.clone();
 
-    cv::Mat out = bgr.clone();
-
-    int midX = out.cols / 2;
-    int midY = out.rows / 2;
+    // Written straight from bgr: no clone pass before the kernel
+    cv::Mat out(bgr.size(), bgr.type());
+    DitherRows rows;
+    rows.build(strength, bgr.cols);
 
-    DitherTask tasks[4] = {
-        { &out, strength, 0,    midX,   0,    midY },          // TL
-        { &out, strength, midX, out.cols, 0,  midY },          // TR
-        { &out, strength, 0,    midX,   midY, out.rows },      // BL
-        { &out, strength, midX, out.cols, midY, out.rows }     // BR
-    };
+    ThreadPool& pool = workerPool();
+    const int bands = std::min(out.rows, pool.size() + 1);
+    if (bands <= 0) return out;
+    const int rowsPerBand = (out.rows + bands - 1) / bands;
 
-    HANDLE threads[4];
-    DWORD threadIds[4];
+    pool.parallelFor(bands, [&](int i) {
+        const DitherTask task = { &bgr, &out, &rows, i * rowsPerBand, (i + 1) * rowsPerBand };
+        DitherWorker(task);
+    });
 
-    for (int i = 0; i < 4; ++i) {
-        threads[i] = CreateThread(
-            nullptr,
-            0,
-            DitherWorker,
-            &tasks[i],
-            0,
-            &threadIds[i]
-        );
+    return out;
+}
 
-        if (threads[i] == nullptr) {
-            std::cerr << "Failed to create dither thread " << i << "\n";
-            // fallback: return non-dithered clone (keep simple & deterministic)
-            return out;
+// The per-pixel loop applyOrderedDither replaced, kept as its reference
+static cv::Mat applyOrderedDitherScalar(const cv::Mat& bgr, int strength) {
+    cv::Mat out = bgr.clone();
+    if (strength <= 0) return out;
+    for (int y = 0; y < out.rows; ++y) {
+        for (int x = 0; x < out.cols; ++x) {
+            const float norm = (float(BAYER8[y & 7][x & 7]) - 31.5f) / 63.0f;
+            const int offset = (int)std::lround(norm * float(strength));
+            cv::Vec3b& p = out.at<cv::Vec3b>(y, x);
+            for (int c = 0; c < 3; ++c) p[c] = clampU8(int(p[c]) + offset);
         }
     }
+    return out;
+}
 
-    WaitForMultipleObjects(4, threads, TRUE, INFINITE);
-
-    for (int i = 0; i < 4; ++i) {
-        CloseHandle(threads[i]);
+// --validate: applyOrderedDither must match the scalar loop exactly on
+// every 24-bit colour (a 4096x4096 image), on crops whose row length is
+// not a multiple of the vector width and on 1-3 pixel images
+static bool validateDither() {
+    cv::Mat colours(4096, 4096, CV_8UC3);
+    for (int y = 0; y < colours.rows; ++y) {
+        uchar* p = colours.ptr<uchar>(y);
+        for (int x = 0; x < colours.cols; ++x, p += 3) {
+            const int i = y * colours.cols + x;
+            p[0] = uchar(i);
+            p[1] = uchar(i >> 8);
+            p[2] = uchar(i >> 16);
+        }
+    }
+    std::vector<cv::Mat> images = { colours };
+    for (int w : {1, 2, 3, 5, 7, 11, 15, 17, 31, 33, 63, 65, 127, 129}) {
+        images.push_back(colours(cv::Rect(w, 3, w, 9)));
+    }
+    for (const cv::Size& tiny : {cv::Size(1, 1), cv::Size(2, 1), cv::Size(1, 3), cv::Size(3, 1)}) {
+        images.push_back(colours(cv::Rect(5, 7, tiny.width, tiny.height)).clone());
     }
 
-    return out;
+    double differing = 0.0;
+    for (const cv::Mat& img : images) {
+        for (int strength : {1, 8, 18, 64, 255}) {
+            cv::Mat diff;
+            cv::absdiff(applyOrderedDither(img, strength), applyOrderedDitherScalar(img, strength), diff);
+            differing += double(cv::countNonZero(diff.reshape(1)));
+        }
+    }
+    std::cout << "dither: " << differing << " bytes differ from the scalar loop  "
+              << (differing == 0.0 ? "ok" : "FAIL") << std::endl;
+    return differing == 0.0;
 }
 
 // ------------------------------------------------------------
@@ -140,42 +339,136 @@ cv::Mat kmeansQuantize(const cv::Mat& bgr, int K, int attempts = 3) {
 }
 
 // ------------------------------------------------------------
-// GBA-style filter
+// Reduced-resolution JPEG loading
 // ------------------------------------------------------------
-cv::Mat gbaRetroFilter(
-    const cv::Mat& inputBgr,
-    int targetWidth = 240,
-    int paletteColors = 16,
-    int ditherStrength = 18,
-    bool addEdgeHint = true
-) {
-    CV_Assert(inputBgr.type() == CV_8UC3);
+static int divUp(int a, int b) { return (a + b - 1) / b; }
 
-    cv::Mat bgr = inputBgr.clone();
-    const int H = bgr.rows;
-    const int W = bgr.cols;
+// EXIF Orientation tag (0x0112) of an APP1 payload, 1 (upright) when the
+// payload is not EXIF or has no such tag. 5..8 swap width and height.
+static int exifOrientation(const std::vector<unsigned char>& app1) {
+    static const char EXIF[6] = { 'E', 'x', 'i', 'f', 0, 0 };
+    if (app1.size() < 6 + 8 || !std::equal(EXIF, EXIF + 6, app1.begin())) return 1;
 
-    // 1) Mild contrast punch via YCrCb luma scaling
-    {
-        cv::Mat ycc;
-        cv::cvtColor(bgr, ycc, cv::COLOR_BGR2YCrCb);
+    const unsigned char* t = app1.data() + 6;  // TIFF header
+    const size_t n = app1.size() - 6;
+    const bool le = t[0] == 'I' && t[1] == 'I';
+    if (!le && !(t[0] == 'M' && t[1] == 'M')) return 1;
+    auto u16 = [&](size_t o) -> uint32_t {
+        if (o + 2 > n) return 0;
+        return le ? t[o] | t[o + 1] << 8 : t[o] << 8 | t[o + 1];
+    };
+    auto u32 = [&](size_t o) -> uint32_t {
+        return le ? u16(o) | u16(o + 2) << 16 : u16(o) << 16 | u16(o + 2);
+    };
+
+    const size_t ifd0 = u32(4);
+    const uint32_t entries = u16(ifd0);
+    for (uint32_t i = 0; i < entries; ++i) {
+        const size_t e = ifd0 + 2 + 12 * size_t(i);
+        if (e + 12 > n) break;
+        if (u16(e) == 0x0112) return int(u16(e + 8));
+    }
+    return 1;
+}
 
-        std::vector<cv::Mat> ch;
-        cv::split(ycc, ch);
+// Reads the frame size from a JPEG's SOFn marker without decoding any
+// pixel data, and the EXIF orientation if an APP1 block before it has one.
+// Returns false for non-JPEG or truncated files.
+static bool readJpegSize(const std::string& path, cv::Size& size, int& orientation) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f || f.get() != 0xFF || f.get() != 0xD8) return false;
+    orientation = 1;
 
-        ch[0].convertTo(ch[0], -1, 1.10, 4.0); // alpha, beta
+    for (;;) {
+        int c = f.get();
+        if (c != 0xFF) return false;
+        do { c = f.get(); } while (c == 0xFF);  // fill bytes
+        if (c == EOF) return false;
 
-        cv::merge(ch, ycc);
-        cv::cvtColor(ycc, bgr, cv::COLOR_YCrCb2BGR);
+        const int marker = c;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;  // no payload
+        if (marker == 0xD9 || marker == 0xDA) return false;                  // EOI / SOS
+
+        const int hi = f.get(), lo = f.get();
+        if (lo == EOF) return false;
+        const int length = (hi << 8) | lo;
+        if (length < 2) return false;
+
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            unsigned char sof[5];
+            if (!f.read(reinterpret_cast<char*>(sof), 5)) return false;
+            size = cv::Size((sof[3] << 8) | sof[4], (sof[1] << 8) | sof[2]);
+            return size.area() > 0;
+        }
+        if (marker == 0xE1) {
+            std::vector<unsigned char> app1(size_t(length) - 2);
+            if (!f.read(reinterpret_cast<char*>(app1.data()), (std::streamsize)app1.size())) return false;
+            if (orientation == 1) orientation = exifOrientation(app1);
+            continue;
+        }
+        f.seekg(length - 2, std::ios::cur);
+        if (!f) return false;
     }
+}
 
-    // 2) Downscale for pixelation base
-    const float scale = float(targetWidth) / float(W);
-    const int targetHeight = std::max(1, int(std::lround(H * scale)));
+// Loads `path` for gbaRetroFilter at `targetWidth`. JPEGs are decoded with
+// libjpeg's DCT scaling (IMREAD_REDUCED_COLOR_8/4/2) at the smallest scale
+// that is still at least targetWidth wide, so the 240 px working image no
+// longer needs a full-resolution decode. fullSize receives the original
+// size (EXIF rotation applied), which is what the output is upscaled to.
+cv::Mat loadImageForFilter(const std::string& path, int targetWidth, cv::Size& fullSize) {
+    cv::Size header;
+    int orientation = 1;
+    if (readJpegSize(path, header, orientation)) {
+        static const struct { int factor; int flag; } REDUCED[] = {
+            {8, cv::IMREAD_REDUCED_COLOR_8}, {4, cv::IMREAD_REDUCED_COLOR_4}, {2, cv::IMREAD_REDUCED_COLOR_2}
+        };
+        // The filter's target is a width, so the scale is chosen by the
+        // width the image has once imread has applied the EXIF orientation
+        const int width = orientation >= 5 && orientation <= 8 ? header.height : header.width;
+        for (const auto& r : REDUCED) {
+            if (divUp(width, r.factor) < targetWidth) continue;
 
-    cv::Mat small;
-    cv::resize(bgr, small, cv::Size(targetWidth, targetHeight), 0, 0, cv::INTER_AREA);
+            cv::Mat img = cv::imread(path, r.flag);
+            if (img.empty()) break;
+            // Orientation this parser missed (or imread ignored): try a
+            // larger scale rather than filter below the target width
+            if (img.cols < targetWidth) continue;
+
+            const bool rotated = header.width != header.height &&
+                                 img.cols == divUp(header.height, r.factor) &&
+                                 img.rows == divUp(header.width, r.factor);
+            fullSize = rotated ? cv::Size(header.height, header.width) : header;
+            return img;
+        }
+    }
 
+    cv::Mat img = cv::imread(path, cv::IMREAD_COLOR);
+    fullSize = img.size();
+    return img;
+}
+
+// ------------------------------------------------------------
+// GBA-style filter
+// ------------------------------------------------------------
+// 1) Mild contrast punch via YCrCb luma scaling, in place. Per-pixel, so it
+// can be applied to a strip of the image as well as to the whole of it.
+static void contrastPunch(cv::Mat& bgr) {
+    cv::Mat ycc;
+    cv::cvtColor(bgr, ycc, cv::COLOR_BGR2YCrCb);
+
+    std::vector<cv::Mat> ch;
+    cv::split(ycc, ch);
+
+    ch[0].convertTo(ch[0], -1, 1.10, 4.0); // alpha, beta
+
+    cv::merge(ch, ycc);
+    cv::cvtColor(ycc, bgr, cv::COLOR_YCrCb2BGR);
+}
+
+// Steps 3-5 on the downscaled image: edge hint, dither, palette reduction
+static cv::Mat retroSmall(cv::Mat small, int paletteColors, int ditherStrength, bool addEdgeHint) {
     // 3) Optional edge hint
     if (addEdgeHint) {
         cv::Mat gray, edges;
@@ -191,11 +484,42 @@ cv::Mat gbaRetroFilter(
         cv::subtract(small, halfEdges, small);
     }
 
-    // 4) Ordered dithering (NOW threaded into 4 subsections)
+    // 4) Ordered dithering (threaded into row bands on the worker pool)
     small = applyOrderedDither(small, ditherStrength);
 
     // 5) Palette reduction via k-means
-    cv::Mat smallQ = kmeansQuantize(small, paletteColors, 3);
+    return kmeansQuantize(small, paletteColors, 3);
+}
+
+// outputSize: size to upscale back to, when inputBgr was decoded at reduced
+// resolution (see loadImageForFilter); empty means inputBgr's own size.
+cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    int targetWidth = 240,
+    int paletteColors = 16,
+    int ditherStrength = 18,
+    bool addEdgeHint = true,
+    cv::Size outputSize = cv::Size()
+) {
+    CV_Assert(inputBgr.type() == CV_8UC3);
+
+    cv::Mat bgr = inputBgr.clone();
+    const cv::Size fullSize = outputSize.area() > 0 ? outputSize : bgr.size();
+    const int H = fullSize.height;
+    const int W = fullSize.width;
+
+    // 1) Contrast
+    contrastPunch(bgr);
+
+    // 2) Downscale for pixelation base
+    const float scale = float(targetWidth) / float(W);
+    const int targetHeight = std::max(1, int(std::lround(H * scale)));
+
+    cv::Mat small;
+    cv::resize(bgr, small, cv::Size(targetWidth, targetHeight), 0, 0, cv::INTER_AREA);
+
+    // 3-5) Edge hint, dither, palette
+    cv::Mat smallQ = retroSmall(small, paletteColors, ditherStrength, addEdgeHint);
 
     // 6) Nearest-neighbor upscale back to original size
     cv::Mat out;
@@ -211,18 +535,738 @@ cv::Mat gbaRetroFilter(
     return out;
 }
 
-int main() {
+// ------------------------------------------------------------
+// Strip-streaming filter for very large inputs
+// ------------------------------------------------------------
+// gbaRetroFilter keeps about five full-resolution images alive at once (the
+// input, its clone, the YCrCb copy, the upscaled output and its blur). The
+// streamed variant below reads the input top to bottom in strips, folds each
+// strip into the small working image, and writes the output in strips too,
+// so apart from the small image it only ever holds a few strips.
+//
+// cv::imread/imwrite cannot decode or encode part of an image, so real strip
+// I/O is done on binary PPM (P6) files. Other formats go through an
+// in-memory source/sink: still one full-size copy each instead of five.
+
+// Supplies the input image, top to bottom, as 8-bit BGR strips
+class RowSource {
+public:
+    virtual ~RowSource() = default;
+    virtual cv::Size size() const = 0;
+    // Reads the next `rows` rows (fewer at the bottom) into `strip`
+    virtual bool read(int rows, cv::Mat& strip) = 0;
+};
+
+// Receives the output image, top to bottom, as 8-bit BGR strips
+class RowSink {
+public:
+    virtual ~RowSink() = default;
+    virtual bool write(const cv::Mat& strip) = 0;
+    virtual bool finish() { return true; }
+};
+
+static bool isPpmPath(const std::string& path) {
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot + 1);
+    for (char& c : ext) c = (char)std::tolower((unsigned char)c);
+    return ext == "ppm" || ext == "pnm";
+}
+
+// Binary 8-bit PPM, read a strip at a time
+class PpmRowSource : public RowSource {
+public:
+    explicit PpmRowSource(const std::string& path) : f_(path, std::ios::binary) {
+        if (!f_) return;
+        std::string magic;
+        int maxval = 0;
+        f_ >> magic;
+        if (magic != "P6") return;
+        if (!readInt(size_.width) || !readInt(size_.height) || !readInt(maxval)) return;
+        f_.get(); // single whitespace byte before the raster
+        ok_ = f_ && maxval == 255 && size_.width > 0 && size_.height > 0;
+    }
+
+    bool ok() const { return ok_; }
+    cv::Size size() const override { return size_; }
+
+    bool read(int rows, cv::Mat& strip) override {
+        rows = std::min(rows, size_.height - next_);
+        if (!ok_ || rows <= 0) return false;
+        rgb_.create(rows, size_.width, CV_8UC3);
+        f_.read((char*)rgb_.data, (std::streamsize)rgb_.total() * 3);
+        if (!f_) return false;
+        cv::cvtColor(rgb_, strip, cv::COLOR_RGB2BGR);
+        next_ += rows;
+        return true;
+    }
+
+private:
+    // Header integer, skipping whitespace and '#' comments
+    bool readInt(int& v) {
+        f_ >> std::ws;
+        while (f_.peek() == '#') {
+            std::string comment;
+            std::getline(f_, comment);
+            f_ >> std::ws;
+        }
+        return (bool)(f_ >> v);
+    }
+
+    std::ifstream f_;
+    cv::Size size_;
+    cv::Mat rgb_;
+    int next_ = 0;
+    bool ok_ = false;
+};
+
+// Image already decoded in memory (any format cv::imread handles). The
+// image is released after its last strip is read, so it is gone before the
+// output half of the filter starts.
+class MatRowSource : public RowSource {
+public:
+    explicit MatRowSource(cv::Mat img) : img_(std::move(img)), size_(img_.size()) {}
+
+    cv::Size size() const override { return size_; }
+
+    bool read(int rows, cv::Mat& strip) override {
+        rows = std::min(rows, size_.height - next_);
+        if (rows <= 0) return false;
+        img_.rowRange(next_, next_ + rows).copyTo(strip);
+        next_ += rows;
+        if (next_ == size_.height) img_.release();
+        return true;
+    }
 
+private:
+    cv::Mat img_;
+    cv::Size size_;
+    int next_ = 0;
+};
+
+// Binary 8-bit PPM, written a strip at a time
+class PpmRowSink : public RowSink {
+public:
+    PpmRowSink(const std::string& path, cv::Size size) : f_(path, std::ios::binary) {
+        f_ << "P6\n" << size.width << " " << size.height << "\n255\n";
+    }
+
+    bool write(const cv::Mat& strip) override {
+        cv::cvtColor(strip, rgb_, cv::COLOR_BGR2RGB);
+        f_.write((const char*)rgb_.data, (std::streamsize)rgb_.total() * 3);
+        return (bool)f_;
+    }
+
+    bool finish() override {
+        f_.flush();
+        return (bool)f_;
+    }
+
+private:
+    std::ofstream f_;
+    cv::Mat rgb_;
+};
+
+// Collects the strips and encodes the whole image with cv::imwrite at the
+// end. The full-size buffer is allocated on the first write, not up front.
+class MatRowSink : public RowSink {
+public:
+    MatRowSink(const std::string& path, cv::Size size)
+        : path_(path), size_(size) {}
+
+    bool write(const cv::Mat& strip) override {
+        img_.create(size_, CV_8UC3);
+        if (next_ + strip.rows > img_.rows) return false;
+        strip.copyTo(img_.rowRange(next_, next_ + strip.rows));
+        next_ += strip.rows;
+        return true;
+    }
+
+    bool finish() override { return next_ == img_.rows && cv::imwrite(path_, img_); }
+
+private:
+    std::string path_;
+    cv::Size size_;
+    cv::Mat img_;
+    int next_ = 0;
+};
+
+// reflect-101 row index, the border GaussianBlur uses by default
+static int reflectRow(int y, int rows) {
+    if (rows == 1) return 0;
+    if (y < 0) return -y;
+    if (y >= rows) return 2 * rows - 2 - y;
+    return y;
+}
+
+// Same filter as gbaRetroFilter, run strip by strip: besides what the source
+// and sink keep, peak memory is the small image plus a few `stripRows`-high
+// strips of the full width. The output is identical to gbaRetroFilter's up
+// to float rounding in the downscale, which is done as two passes instead of
+// one (at most one level per channel). An input shorter than the small image
+// is not downscaled at all (INTER_AREA then interpolates instead of
+// averaging boxes, which the row accumulation cannot reproduce); it is small
+// enough to run through gbaRetroFilter in one piece.
+bool gbaRetroFilterStreamed(
+    RowSource& src,
+    RowSink& dst,
+    int targetWidth = 240,
+    int paletteColors = 16,
+    int ditherStrength = 18,
+    bool addEdgeHint = true,
+    int stripRows = 256
+) {
+    const cv::Size fullSize = src.size();
+    const int H = fullSize.height;
+    const int W = fullSize.width;
+    stripRows = std::max(1, stripRows);
+
+    const float scale = float(targetWidth) / float(W);
+    const int targetHeight = std::max(1, int(std::lround(H * scale)));
+
+    if (targetHeight > H) {
+        cv::Mat whole(H, W, CV_8UC3), strip;
+        for (int y0 = 0; y0 < H; y0 += strip.rows) {
+            if (!src.read(stripRows, strip)) return false;
+            CV_Assert(strip.type() == CV_8UC3 && strip.cols == W && y0 + strip.rows <= H);
+            strip.copyTo(whole.rowRange(y0, y0 + strip.rows));
+        }
+        const cv::Mat out = gbaRetroFilter(whole, targetWidth, paletteColors,
+                                           ditherStrength, addEdgeHint);
+        for (int y0 = 0; y0 < H; y0 += stripRows) {
+            if (!dst.write(out.rowRange(y0, std::min(H, y0 + stripRows)))) return false;
+        }
+        return dst.finish();
+    }
+
+    // 1-2) Contrast and area downscale, strip by strip. Each strip is shrunk
+    // horizontally with INTER_AREA, then every input row is added to the
+    // small rows it overlaps, weighted by the overlap: the same box average
+    // INTER_AREA computes over the whole image.
+    cv::Mat acc(targetHeight, targetWidth, CV_32FC3, cv::Scalar::all(0));
+    const double rowsPerSmall = double(H) / targetHeight;
+    cv::Mat strip, stripF, narrow;
+    for (int y0 = 0; y0 < H; y0 += strip.rows) {
+        if (!src.read(stripRows, strip)) return false;
+        CV_Assert(strip.type() == CV_8UC3 && strip.cols == W);
+
+        contrastPunch(strip);
+        strip.convertTo(stripF, CV_32F);
+        cv::resize(stripF, narrow, cv::Size(targetWidth, strip.rows), 0, 0, cv::INTER_AREA);
+
+        for (int r = 0; r < narrow.rows; ++r) {
+            const double top = y0 + r;
+            const int first = std::min(targetHeight - 1, int(top / rowsPerSmall));
+            for (int sy = std::max(0, first - 1); sy < targetHeight; ++sy) {
+                const double overlap = std::min(top + 1.0, (sy + 1) * rowsPerSmall)
+                                     - std::max(top, sy * rowsPerSmall);
+                if (overlap <= 0.0) {
+                    if (sy > first) break;
+                    continue;
+                }
+                cv::scaleAdd(narrow.row(r), overlap / rowsPerSmall, acc.row(sy), acc.row(sy));
+            }
+        }
+    }
+
+    cv::Mat small;
+    acc.convertTo(small, CV_8U);
+    acc.release();
+
+    // 3-5) Edge hint, dither, palette
+    const cv::Mat smallQ = retroSmall(small, paletteColors, ditherStrength, addEdgeHint);
+
+    // 6-7) Nearest-neighbour upscale and sharpen, strip by strip. Each strip
+    // carries one halo row above and below (reflected at the image edges) so
+    // the 3x3 blur sees the same neighbours as on the whole image. Source
+    // coordinates follow cv::resize's INTER_NEAREST mapping.
+    const double ifx = 1.0 / (double(W) / smallQ.cols);
+    const double ify = 1.0 / (double(H) / smallQ.rows);
+    std::vector<int> xmap(W);
+    for (int x = 0; x < W; ++x) xmap[x] = std::min(cvFloor(x * ifx), smallQ.cols - 1);
+
+    cv::Mat up, blurred, outStrip;
+    for (int y0 = 0; y0 < H; y0 += stripRows) {
+        const int rows = std::min(stripRows, H - y0);
+        up.create(rows + 2, W, CV_8UC3);
+        for (int r = 0; r < rows + 2; ++r) {
+            const int y = reflectRow(y0 + r - 1, H);
+            const cv::Vec3b* s = smallQ.ptr<cv::Vec3b>(std::min(cvFloor(y * ify), smallQ.rows - 1));
+            cv::Vec3b* d = up.ptr<cv::Vec3b>(r);
+            for (int x = 0; x < W; ++x) d[x] = s[xmap[x]];
+        }
+
+        cv::GaussianBlur(up, blurred, cv::Size(3, 3), 0);
+        cv::addWeighted(up.rowRange(1, rows + 1), 1.15,
+                        blurred.rowRange(1, rows + 1), -0.15, 0.0, outStrip);
+        if (!dst.write(outStrip)) return false;
+    }
+
+    return dst.finish();
+}
+
+// ------------------------------------------------------------
+// Batch processing
+// ------------------------------------------------------------
+// gbaRetroFilter parameters, shared by the single-image and batch modes
+struct FilterParams {
+    int targetWidth = 240;
+    int paletteColors = 16;
+    int ditherStrength = 18;
+    bool addEdgeHint = true;
+};
+
+struct BatchConfig {
+    int workers = 0;   // concurrent filter threads, 0 = one per core
+    int readers = 2;   // decode threads prefetching the next inputs
+    int writers = 2;   // encode threads
+    int prefetch = 0;  // images queued between stages, 0 = 2 per worker
+};
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// Blocking FIFO with a fixed capacity. push() waits while the queue is
+// full, pop() waits while it is empty; after close() pushes fail and pops
+// drain what is left, then fail.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        cvNotEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        cvNotFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        cvNotFull.notify_all();
+        cvNotEmpty.notify_all();
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cvNotFull, cvNotEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+};
+
+static std::string lowerExtension(const fs::path& p) {
+    std::string ext = p.extension().string();
+    for (char& c : ext) c = (char)std::tolower((unsigned char)c);
+    return ext;
+}
+
+static bool isImagePath(const fs::path& p) {
+    static const char* const exts[] = {
+        ".jpg", ".jpeg", ".jpe", ".png", ".bmp", ".tif", ".tiff",
+        ".webp", ".ppm", ".pnm", ".pgm", ".pbm"
+    };
+    const std::string ext = lowerExtension(p);
+    for (const char* e : exts) {
+        if (ext == e) return true;
+    }
+    return false;
+}
+
+// Where the result for `input` goes: `outDir` (keeping the path below the
+// directory it was found in, `root`) or next to the input when empty
+static std::string outputPathFor(const fs::path& input, const fs::path& root,
+                                 const std::string& outDir,
+                                 const std::string& suffix, const std::string& ext) {
+    const std::string name = input.stem().string() + suffix + ext;
+    if (outDir.empty()) return (input.parent_path() / name).string();
+
+    fs::path rel;
+    if (!root.empty()) rel = input.parent_path().lexically_relative(root);
+    if (rel == ".") rel.clear();
+    return (fs::path(outDir) / rel / name).string();
+}
+
+// Expands the command line into jobs. Inputs are image files or
+// directories (image files inside, optionally recursive); manifests list
+// one input per line, optionally followed by a tab and its output path.
+// Blank lines and lines starting with '#' are skipped. Directory scans skip
+// files whose stem already ends in `suffix`, so running twice over the same
+// folder does not filter the previous results again.
+static bool collectJobs(const std::vector<std::string>& inputs,
+                        const std::vector<std::string>& manifests,
+                        bool recursive, const std::string& outDir,
+                        const std::string& suffix, const std::string& ext,
+                        std::vector<BatchJob>& jobs) {
+    for (const std::string& m : manifests) {
+        std::ifstream f(m);
+        if (!f) {
+            std::cerr << "Error: could not read manifest: " << m << "\n";
+            return false;
+        }
+        std::string line;
+        while (std::getline(f, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            const size_t tab = line.find('\t');
+            BatchJob job;
+            job.input = line.substr(0, tab);
+            job.output = tab != std::string::npos
+                ? line.substr(tab + 1)
+                : outputPathFor(job.input, fs::path(), outDir, suffix, ext);
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    for (const std::string& in : inputs) {
+        std::error_code ec;
+        if (!fs::is_directory(in, ec)) {
+            jobs.push_back({ in, outputPathFor(in, fs::path(), outDir, suffix, ext) });
+            continue;
+        }
+
+        // Sorted so runs over the same tree produce the same job order
+        std::vector<fs::path> found;
+        auto visit = [&](const fs::directory_entry& e) {
+            std::error_code fileEc;
+            if (!e.is_regular_file(fileEc) || !isImagePath(e.path())) return;
+            const std::string stem = e.path().stem().string();
+            const bool isResult = !suffix.empty() && stem.size() > suffix.size()
+                && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0;
+            if (!isResult) found.push_back(e.path());
+        };
+        if (recursive) {
+            for (const auto& e : fs::recursive_directory_iterator(in, ec)) visit(e);
+        } else {
+            for (const auto& e : fs::directory_iterator(in, ec)) visit(e);
+        }
+        if (ec) {
+            std::cerr << "Error: could not list directory: " << in << ": " << ec.message() << "\n";
+            return false;
+        }
+        std::sort(found.begin(), found.end());
+        for (const fs::path& p : found) {
+            jobs.push_back({ p.string(), outputPathFor(p, in, outDir, suffix, ext) });
+        }
+    }
+    return true;
+}
+
+// Two jobs writing the same file would race in the writer threads and the
+// later one would silently replace the earlier result (e.g. a.png and a.jpg
+// with --out-dir), so such batches are refused before anything runs.
+static bool checkOutputsUnique(const std::vector<BatchJob>& jobs) {
+    std::map<std::string, size_t> firstJob;
+    bool ok = true;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const std::string key = fs::path(jobs[i].output).lexically_normal().string();
+        const auto it = firstJob.emplace(key, i);
+        if (it.second) continue;
+        std::cerr << "Error: " << jobs[it.first->second].input << " and " << jobs[i].input
+                  << " would both be written to " << jobs[i].output << "\n";
+        ok = false;
+    }
+    return ok;
+}
+
+struct BatchItem {
+    size_t job = 0;
+    cv::Mat img;
+    cv::Size fullSize;
+};
+
+// Three stages connected by bounded queues: readers decode the next inputs
+// ahead of the filters, the filter threads run gbaRetroFilter on separate
+// images, and writers encode the results. Order does not matter in a batch,
+// so nothing is reordered. Returns the number of images that failed.
+static int runBatch(const std::vector<BatchJob>& jobs, const FilterParams& p, const BatchConfig& cfg) {
+    const int hw = (int)std::max(1u, std::thread::hardware_concurrency());
+    const int workers = cfg.workers > 0 ? cfg.workers : hw;
+    const size_t depth = cfg.prefetch > 0 ? (size_t)cfg.prefetch : 2 * (size_t)workers;
+
+    BoundedQueue<BatchItem> loaded(depth), filtered(depth);
+    std::atomic<size_t> nextJob{0};
+    std::atomic<int> failed{0}, written{0};
+    std::mutex logMtx;
+
+    auto fail = [&](const std::string& msg) {
+        std::lock_guard<std::mutex> lock(logMtx);
+        std::cerr << "Error: " << msg << "\n";
+        failed++;
+    };
+
+    auto readStage = [&] {
+        for (;;) {
+            const size_t i = nextJob.fetch_add(1);
+            if (i >= jobs.size()) return;
+            BatchItem item;
+            item.job = i;
+            item.img = loadImageForFilter(jobs[i].input, p.targetWidth, item.fullSize);
+            if (item.img.empty()) {
+                fail("could not read input image: " + jobs[i].input);
+                continue;
+            }
+            if (!loaded.push(std::move(item))) return;
+        }
+    };
+
+    auto filterStage = [&] {
+        BatchItem item;
+        while (loaded.pop(item)) {
+            try {
+                item.img = gbaRetroFilter(item.img, p.targetWidth, p.paletteColors,
+                                          p.ditherStrength, p.addEdgeHint, item.fullSize);
+            } catch (const std::exception& e) {
+                // cv::Exception, but also std::bad_alloc on a huge input
+                fail("filter failed on " + jobs[item.job].input + ": " + e.what());
+                continue;
+            }
+            if (!filtered.push(std::move(item))) return;
+        }
+    };
+
+    auto writeStage = [&] {
+        BatchItem item;
+        while (filtered.pop(item)) {
+            const std::string& out = jobs[item.job].output;
+            std::error_code ec;
+            const fs::path dir = fs::path(out).parent_path();
+            if (!dir.empty()) fs::create_directories(dir, ec);
+
+            bool ok = false;
+            try {
+                ok = cv::imwrite(out, item.img);
+            } catch (const std::exception&) {
+                ok = false;
+            }
+            if (ok) written++;
+            else fail("could not write output image: " + out);
+        }
+    };
+
+    // Stage threads are joined in pipeline order; each queue is closed once
+    // everything feeding it has finished
+    auto spawn = [](int n, const std::function<void()>& fn, std::vector<std::thread>& threads) {
+        for (int i = 0; i < n; ++i) {
+            try {
+                threads.emplace_back(fn);
+            } catch (const std::system_error& e) {
+                std::cerr << "Failed to create batch thread: " << e.what() << "\n";
+                break;
+            }
+        }
+        return !threads.empty();
+    };
+    auto joinAll = [](std::vector<std::thread>& threads) {
+        for (std::thread& t : threads) t.join();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> readThreads, filterThreads, writeThreads;
+    const bool started = spawn(std::max(1, cfg.readers), readStage, readThreads)
+                      && spawn(workers, filterStage, filterThreads)
+                      && spawn(std::max(1, cfg.writers), writeStage, writeThreads);
+    if (!started) {
+        nextJob = jobs.size();
+        loaded.close();
+        filtered.close();
+    }
+
+    joinAll(readThreads);
+    loaded.close();
+    joinAll(filterThreads);
+    filtered.close();
+    joinAll(writeThreads);
+
+    if (!started) return (int)jobs.size();
+
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote " << written.load() << " of " << jobs.size() << " images in "
+              << sec << " s (" << (sec > 0.0 ? written.load() / sec : 0.0) << " images/s, "
+              << filterThreads.size() << " filter threads)" << std::endl;
+    return failed.load();
+}
+
+static void printUsage() {
+    std::cerr <<
+        "Usage: OpenCVExample [inputs...] [options]\n"
+        "  inputs                 image files or directories (default: test.jpg)\n"
+        "  -o FILE                output for a single input (default: gba_output.png)\n"
+        "  --list FILE            manifest: one input per line, optionally <TAB>output\n"
+        "  --out-dir DIR          batch output directory (default: next to each input)\n"
+        "  --suffix S             batch output name suffix (default: _gba)\n"
+        "  --ext EXT              batch output extension (default: .png)\n"
+        "  --recursive            descend into subdirectories\n"
+        "  --width N              internal (pixelated) width (default: 240)\n"
+        "  --colors K             palette size (default: 16)\n"
+        "  --dither N             ordered dither strength, 0 = off (default: 18)\n"
+        "  --no-edge-hint         skip the Canny edge darkening\n"
+        "  --jobs N               concurrent filter threads (default: one per core)\n"
+        "  --readers N            decode threads (default: 2)\n"
+        "  --writers N            encode threads (default: 2)\n"
+        "  --prefetch N           images queued between stages (default: 2 per job)\n"
+        "  --stream               strip-streaming mode for one very large input\n"
+        "  --strip-rows N         rows per strip in --stream mode (default: 256)\n"
+        "  --no-preview           do not show the result of a single input\n"
+        "  --validate             check the SIMD dither against the scalar loop and exit\n";
+}
+
+int main(int argc, char** argv) {
+    FilterParams params;
+    BatchConfig batch;
+    std::vector<std::string> inputs, manifests;
+    std::string outputPath;
+    std::string outDir;
+    std::string suffix = "_gba";
+    std::string ext = ".png";
+    bool recursive = false;
+    bool stream = false;
+    int stripRows = 256;
+    bool showPreview = true;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if ((arg == "-o" || arg == "--output") && hasValue) {
+            outputPath = argv[++i];
+        } else if (arg == "--list" && hasValue) {
+            manifests.push_back(argv[++i]);
+        } else if (arg == "--out-dir" && hasValue) {
+            outDir = argv[++i];
+        } else if (arg == "--suffix" && hasValue) {
+            suffix = argv[++i];
+        } else if (arg == "--ext" && hasValue) {
+            ext = argv[++i];
+            if (!ext.empty() && ext[0] != '.') ext = "." + ext;
+        } else if (arg == "--recursive") {
+            recursive = true;
+        } else if (arg == "--width" && hasValue) {
+            params.targetWidth = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--colors" && hasValue) {
+            params.paletteColors = std::max(2, std::min(256, std::atoi(argv[++i])));
+        } else if (arg == "--dither" && hasValue) {
+            params.ditherStrength = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--no-edge-hint") {
+            params.addEdgeHint = false;
+        } else if (arg == "--jobs" && hasValue) {
+            batch.workers = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--readers" && hasValue) {
+            batch.readers = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--writers" && hasValue) {
+            batch.writers = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--prefetch" && hasValue) {
+            batch.prefetch = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--strip-rows" && hasValue) {
+            stripRows = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--no-preview") {
+            showPreview = false;
+        } else if (arg == "--validate") {
+            return validateDither() ? 0 : 1;
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Error: unknown option: " << arg << "\n";
+            printUsage();
+            return -1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Batch mode: several inputs, a directory, a manifest or --out-dir
     // ------------------------------------------------------------
-    // Paths (current working directory)
+    std::error_code ec;
+    const bool batchMode = !manifests.empty() || !outDir.empty() || inputs.size() > 1
+                        || (inputs.size() == 1 && fs::is_directory(inputs[0], ec));
+    if (batchMode) {
+        if (!outputPath.empty() || stream) {
+            std::cerr << "Error: -o and --stream take a single input; use --out-dir for batches\n";
+            return -1;
+        }
+        std::vector<BatchJob> jobs;
+        if (!collectJobs(inputs, manifests, recursive, outDir, suffix, ext, jobs)) return -1;
+        if (jobs.empty()) {
+            std::cerr << "Error: no input images found\n";
+            return -1;
+        }
+        if (!checkOutputsUnique(jobs)) return -1;
+
+        // Parallelism comes from filtering separate images at once; letting
+        // every resize/kmeans/Canny call also fan out over OpenCV's own
+        // threads only oversubscribes the cores
+        cv::setNumThreads(1);
+        return runBatch(jobs, params, batch) == 0 ? 0 : 1;
+    }
+
     // ------------------------------------------------------------
-    const std::string inputPath  = "test.jpg";
-    const std::string outputPath = "gba_output.png";
+    // Paths (current working directory by default)
+    // ------------------------------------------------------------
+    const std::string inputPath  = inputs.empty() ? "test.jpg" : inputs[0];
+    if (outputPath.empty()) outputPath = "gba_output.png";
 
     // ------------------------------------------------------------
-    // Load input image
+    // --stream: strip-streaming mode for huge scans
     // ------------------------------------------------------------
-    cv::Mat img = cv::imread(inputPath, cv::IMREAD_COLOR);
+    if (stream) {
+        std::unique_ptr<RowSource> src;
+        if (isPpmPath(inputPath)) {
+            auto ppm = std::make_unique<PpmRowSource>(inputPath);
+            if (ppm->ok()) src = std::move(ppm);
+        } else {
+            cv::Mat full = cv::imread(inputPath, cv::IMREAD_COLOR);
+            if (!full.empty()) src = std::make_unique<MatRowSource>(std::move(full));
+        }
+        if (!src) {
+            std::cerr << "Error: could not read input image: " << inputPath << std::endl;
+            return -1;
+        }
+
+        std::unique_ptr<RowSink> dst;
+        if (isPpmPath(outputPath)) dst = std::make_unique<PpmRowSink>(outputPath, src->size());
+        else                       dst = std::make_unique<MatRowSink>(outputPath, src->size());
+
+        if (!gbaRetroFilterStreamed(*src, *dst, params.targetWidth, params.paletteColors,
+                                    params.ditherStrength, params.addEdgeHint, stripRows)) {
+            std::cerr << "Error: could not write output image" << std::endl;
+            return -1;
+        }
+
+        std::cout << "Saved output image: " << outputPath << std::endl;
+        return 0;
+    }
+
+    // ------------------------------------------------------------
+    // Load input image (JPEGs at reduced resolution when possible)
+    // ------------------------------------------------------------
+    cv::Size fullSize;
+    cv::Mat img = loadImageForFilter(inputPath, params.targetWidth, fullSize);
     if (img.empty()) {
         std::cerr << "Error: could not read input image: " << inputPath << std::endl;
         return -1;
@@ -233,14 +1277,15 @@ int main() {
     // ------------------------------------------------------------
     cv::Mat gbaImage = gbaRetroFilter(
         img,
-        240,   // target width
-        16,    // palette size
-        18,    // dither strength
-        true   // edge hint
+        params.targetWidth,
+        params.paletteColors,
+        params.ditherStrength,
+        params.addEdgeHint,
+        fullSize
     );
 
     // ------------------------------------------------------------
-    // Save output image (same folder)
+    // Save output image
     // ------------------------------------------------------------
     if (!cv::imwrite(outputPath, gbaImage)) {
         std::cerr << "Error: could not write output image" << std::endl;
@@ -250,11 +1295,17 @@ int main() {
     std::cout << "Saved output image: " << outputPath << std::endl;
 
     // ------------------------------------------------------------
-    // Display results
+    // Display results (skipped in RETRO_HEADLESS builds)
     // ------------------------------------------------------------
-    cv::imshow("Original", img);
-    cv::imshow("GBA Retro Output", gbaImage);
-    cv::waitKey(0);
+#ifndef RETRO_HEADLESS
+    if (showPreview) {
+        cv::imshow("Original", img);
+        cv::imshow("GBA Retro Output", gbaImage);
+        cv::waitKey(0);
+    }
+#else
+    (void)showPreview;
+#endif
 
     return 0;
 }
@@ -5,9 +5,16 @@
 // Usage:
 //   ./gba_filter input.jpg output_gba.png
 
+#ifdef RETRO_HEADLESS
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#else
 #include <opencv2/opencv.hpp>
+#endif
 #include <iostream>
 #include <vector>
+#include <string>
 
 static const int BAYER8[8][8] = {
     { 0, 48, 12, 60,  3, 51, 15, 63},
@@ -150,13 +157,13 @@ cv::Mat gbaRetroFilter(
     return out;
 }
 
-int main() {
+int main(int argc, char** argv) {
 
     // ------------------------------------------------------------
-    // Paths (current working directory)
+    // Paths (default: current working directory)
     // ------------------------------------------------------------
-    const std::string inputPath  = "test.jpg";
-    const std::string outputPath = "gba_output.png";
+    const std::string inputPath  = argc > 1 ? argv[1] : "test.jpg";
+    const std::string outputPath = argc > 2 ? argv[2] : "gba_output.png";
 
     // ------------------------------------------------------------
     // Load input image
@@ -189,11 +196,13 @@ int main() {
     std::cout << "Saved output image: " << outputPath << std::endl;
 
     // ------------------------------------------------------------
-    // Display results
+    // Display results (skipped in RETRO_HEADLESS builds)
     // ------------------------------------------------------------
+#ifndef RETRO_HEADLESS
     cv::imshow("Original", img);
     cv::imshow("GBA Retro Output", gbaImage);
     cv::waitKey(0);
+#endif
 
     return 0;
 }
@@ -1,191 +1,868 @@
-// main.cpp (GIF input -> GBA filter per frame -> MP4 output) - OpenCV only
+// main.cpp (GIF input -> GBA filter per frame -> MP4 output) - OpenCV + std::thread
+#ifdef RETRO_HEADLESS
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#else
 #include <opencv2/opencv.hpp>
+#endif
+#include "retro_filter.hpp"
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #include <iostream>
 #include <vector>
 #include <cmath>
-#include <windows.h>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+// ---------------------- Frame queues ----------------------
+// Fixed-capacity FIFO between pipeline stages. push() blocks while full and
+// pop() blocks while empty; after close() pushes are refused and pop()
+// drains what is left, then returns false.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        cvNotEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        cvNotFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        cvNotFull.notify_all();
+        cvNotEmpty.notify_all();
+    }
 
-// ---------------------- Bayer + clamp ----------------------
-static const int BAYER8[8][8] = {
-    { 0, 48, 12, 60,  3, 51, 15, 63},
-    {32, 16, 44, 28, 35, 19, 47, 31},
-    { 8, 56,  4, 52, 11, 59,  7, 55},
-    {40, 24, 36, 20, 43, 27, 39, 23},
-    { 2, 50, 14, 62,  1, 49, 13, 61},
-    {34, 18, 46, 30, 33, 17, 45, 29},
-    {10, 58,  6, 54,  9, 57,  5, 53},
-    {42, 26, 38, 22, 41, 25, 37, 21}
+private:
+    std::mutex mtx;
+    std::condition_variable cvNotFull, cvNotEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
 };
 
-static inline uchar clampU8(int v) {
-    return (uchar)std::max(0, std::min(255, v));
-}
+// Caps the frames between decode and write. The queues alone do not: the
+// encoder parks out-of-order frames, so one slow frame would let the other
+// workers keep pulling and the parked frames (and FramePool) grow without
+// limit. wait(index) blocks the decoder while index - written >= size.
+class FrameWindow {
+public:
+    explicit FrameWindow(int size) : size(std::max(1, size)) {}
+
+    // Returns false once closed
+    bool wait(int index) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvAdvanced.wait(lock, [&] { return closed || index - written < size; });
+        return !closed;
+    }
+
+    // Frames [0, count) have been written
+    void advance(int count) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            written = count;
+        }
+        cvAdvanced.notify_all();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        cvAdvanced.notify_all();
+    }
 
-// ---------------------- Threaded dithering ----------------------
-struct DitherTask {
-    cv::Mat* img;     // CV_8UC3
-    int strength;
-    int x0, x1;       // [x0, x1)
-    int y0, y1;       // [y0, y1)
+private:
+    std::mutex mtx;
+    std::condition_variable cvAdvanced;
+    int size;
+    int written = 0;
+    bool closed = false;
 };
 
-DWORD WINAPI DitherWorker(LPVOID param) {
-    DitherTask* t = reinterpret_cast<DitherTask*>(param);
-    cv::Mat& out = *(t->img);
+// Recycles frame Mats between stages. A released Mat keeps its allocation,
+// so cap.read() and gbaRetroFilter() write into it without reallocating
+// once the frame size is known. The pool only grows to the number of
+// frames in flight, which FrameWindow bounds.
+class FramePool {
+public:
+    cv::Mat acquire() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (spare.empty()) return cv::Mat();
+        cv::Mat m = spare.back();
+        spare.pop_back();
+        return m;
+    }
 
-    const int h = out.rows;
-    const int w = out.cols;
+    // Takes the caller's handle so the pool holds the only reference
+    void release(cv::Mat& m) {
+        if (m.empty()) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        spare.push_back(m);
+        m.release();
+    }
 
-    const int startY = std::max(0, t->y0);
-    const int endY   = std::min(h, t->y1);
-    const int startX = std::max(0, t->x0);
-    const int endX   = std::min(w, t->x1);
+private:
+    std::mutex mtx;
+    std::vector<cv::Mat> spare;
+};
 
-    for (int y = startY; y < endY; ++y) {
-        const int by = y & 7;
-        for (int x = startX; x < endX; ++x) {
-            const int bx = x & 7;
-            const int tval = BAYER8[by][bx]; // 0..63
+// ---------------------- Preview ----------------------
+#ifndef RETRO_HEADLESS
+// Shows the latest frame pair on its own thread. post() overwrites a frame
+// that has not been shown yet, so a slow display drops frames instead of
+// stalling the caller. ESC in a preview window sets stopRequested().
+// All highgui calls stay on this one thread.
+class PreviewWindow {
+public:
+    PreviewWindow() : thread([this] { displayLoop(); }) {}
+
+    ~PreviewWindow() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cvFrame.notify_one();
+        thread.join();
+    }
 
-            const float norm = (float(tval) - 31.5f) / 63.0f;
-            const int offset = (int)std::lround(norm * float(t->strength));
+    PreviewWindow(const PreviewWindow&) = delete;
+    PreviewWindow& operator=(const PreviewWindow&) = delete;
 
-            cv::Vec3b& p = out.at<cv::Vec3b>(y, x);
-            p[0] = clampU8(int(p[0]) + offset);
-            p[1] = clampU8(int(p[1]) + offset);
-            p[2] = clampU8(int(p[2]) + offset);
+    void post(const cv::Mat& src, const cv::Mat& out) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            src.copyTo(latestSrc);
+            out.copyTo(latestOut);
+            fresh = true;
         }
+        cvFrame.notify_one();
     }
-    return 0;
+
+    bool stopRequested() const { return escPressed.load(); }
+
+private:
+    void displayLoop() {
+        cv::Mat shownSrc, shownOut;
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping) {
+            // Time out regularly so the windows keep processing events
+            cvFrame.wait_for(lock, std::chrono::milliseconds(30), [this] { return fresh || stopping; });
+            if (stopping) break;
+            const bool show = fresh;
+            if (show) {
+                cv::swap(shownSrc, latestSrc);
+                cv::swap(shownOut, latestOut);
+                fresh = false;
+            }
+            lock.unlock();
+
+            if (show) {
+                cv::imshow("GIF Frame (Original)", shownSrc);
+                cv::imshow("GIF Frame (GBA)", shownOut);
+            }
+            if (cv::waitKey(1) == 27) escPressed = true;
+
+            lock.lock();
+        }
+        lock.unlock();
+        cv::destroyAllWindows();
+    }
+
+    std::mutex mtx;
+    std::condition_variable cvFrame;
+    cv::Mat latestSrc, latestOut;
+    bool fresh = false;
+    bool stopping = false;
+    std::atomic<bool> escPressed{false};
+    std::thread thread;  // last: started after the state above exists
+};
+#else
+// Headless build: no highgui, so there is nothing to show
+class PreviewWindow {
+public:
+    void post(const cv::Mat&, const cv::Mat&) {}
+    bool stopRequested() const { return false; }
+};
+#endif
+
+// ---------------------- Timing report ----------------------
+// Nearest-rank percentile of an ascending vector
+static double percentileOf(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    const size_t k = (size_t)std::ceil(p * (double)sorted.size());
+    return sorted[std::min(sorted.size() - 1, k > 0 ? k - 1 : 0)];
 }
 
-cv::Mat applyOrderedDither(const cv::Mat& bgr, int strength) {
-    CV_Assert(bgr.type() == CV_8UC3);
-    if (strength <= 0) return bgr.clone();
+// Collects one StageTimings row per frame (rows may arrive out of order
+// from pipeline workers) and writes count/mean/p50/p99 per stage followed
+// by the per-frame rows. A .json path gets JSON, anything else CSV.
+class TimingReport {
+public:
+    void add(int frame, const StageTimings& t) {
+        std::lock_guard<std::mutex> lock(mtx);
+        rows.push_back({frame, t});
+    }
 
-    cv::Mat out = bgr.clone();
+    bool write(const std::string& path) const {
+        std::vector<Row> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            sorted = rows;
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const Row& a, const Row& b) { return a.frame < b.frame; });
+
+        // Columns: every stage, then the frame total
+        const int columns = StageCount + 1;
+        std::vector<Summary> summary(columns);
+        std::vector<double> values(sorted.size());
+        for (int c = 0; c < columns; ++c) {
+            for (size_t i = 0; i < sorted.size(); ++i) values[i] = column(sorted[i].t, c);
+            summary[c] = summarize(values);
+        }
 
-    int midX = out.cols / 2;
-    int midY = out.rows / 2;
+        std::ofstream f(path);
+        if (!f) return false;
+        f << std::fixed << std::setprecision(4);
+
+        const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json) {
+            f << "{\n  \"frames\": " << sorted.size() << ",\n  \"stages\": {\n";
+            for (int c = 0; c < columns; ++c) {
+                const Summary& s = summary[c];
+                f << "    \"" << columnName(c) << "\": {\"count\": " << s.count
+                  << ", \"mean_ms\": " << s.mean << ", \"p50_ms\": " << s.p50
+                  << ", \"p99_ms\": " << s.p99 << "}" << (c + 1 < columns ? ",\n" : "\n");
+            }
+            f << "  },\n  \"per_frame\": [\n";
+            for (size_t i = 0; i < sorted.size(); ++i) {
+                f << "    {\"frame\": " << sorted[i].frame;
+                for (int c = 0; c < columns; ++c) f << ", \"" << columnName(c) << "\": " << column(sorted[i].t, c);
+                f << "}" << (i + 1 < sorted.size() ? ",\n" : "\n");
+            }
+            f << "  ]\n}\n";
+        } else {
+            // Summary block, blank line, per-frame block
+            f << "stage,count,mean_ms,p50_ms,p99_ms\n";
+            for (int c = 0; c < columns; ++c) {
+                const Summary& s = summary[c];
+                f << columnName(c) << "," << s.count << "," << s.mean << "," << s.p50 << "," << s.p99 << "\n";
+            }
+            f << "\nframe";
+            for (int c = 0; c < columns; ++c) f << "," << columnName(c);
+            f << "\n";
+            for (const Row& r : sorted) {
+                f << r.frame;
+                for (int c = 0; c < columns; ++c) f << "," << column(r.t, c);
+                f << "\n";
+            }
+        }
+        return bool(f);
+    }
 
-    DitherTask tasks[4] = {
-        { &out, strength, 0,    midX,    0,    midY },      // TL
-        { &out, strength, midX, out.cols, 0,    midY },     // TR
-        { &out, strength, 0,    midX,    midY, out.rows },  // BL
-        { &out, strength, midX, out.cols, midY, out.rows }  // BR
+private:
+    struct Row {
+        int frame;
+        StageTimings t;
     };
 
-    HANDLE threads[4];
-    DWORD threadIds[4];
+    struct Summary {
+        size_t count = 0;
+        double mean = 0.0, p50 = 0.0, p99 = 0.0;
+    };
 
-    for (int i = 0; i < 4; ++i) {
-        threads[i] = CreateThread(nullptr, 0, DitherWorker, &tasks[i], 0, &threadIds[i]);
-        if (threads[i] == nullptr) {
-            std::cerr << "Failed to create dither thread " << i << "\n";
-            return out; // fallback: return clone (not fatal)
-        }
+    static const char* columnName(int c) { return c < StageCount ? STAGE_NAMES[c] : "total"; }
+    static double column(const StageTimings& t, int c) { return c < StageCount ? t.ms[c] : t.total(); }
+
+    static Summary summarize(std::vector<double>& v) {
+        Summary s;
+        s.count = v.size();
+        if (v.empty()) return s;
+        std::sort(v.begin(), v.end());
+        double sum = 0.0;
+        for (double x : v) sum += x;
+        s.mean = sum / (double)v.size();
+        s.p50 = percentileOf(v, 0.50);
+        s.p99 = percentileOf(v, 0.99);
+        return s;
     }
 
-    WaitForMultipleObjects(4, threads, TRUE, INFINITE);
-    for (int i = 0; i < 4; ++i) CloseHandle(threads[i]);
+    mutable std::mutex mtx;
+    std::vector<Row> rows;
+};
+
+// ---------------------- Video drivers ----------------------
+// Counters reported after the last frame
+struct RunTotals {
+    int frames = 0;
+    int warmFits = 0, fullFits = 0, reusedFrames = 0;
+    double compactness = 0.0, reference = 0.0;  // subsample validation
+};
 
-    return out;
+static void addContextTotals(const RetroFilterContext& ctx, RunTotals& totals) {
+    totals.warmFits += ctx.warm.warmFits;
+    totals.fullFits += ctx.warm.fullFits;
+    totals.reusedFrames += ctx.warm.reusedFrames;
 }
 
-// ---------------------- K-means quantization ----------------------
-cv::Mat kmeansQuantize(const cv::Mat& bgr, int K, int attempts = 3) {
-    CV_Assert(bgr.type() == CV_8UC3);
-    CV_Assert(K >= 2);
+// One frame at a time: read, filter, write.
+static void runSerial(cv::VideoCapture& cap, cv::Mat first, cv::VideoWriter& writer,
+                      const RetroFilterOptions& opt, bool warmStart, PreviewWindow* preview,
+                      TimingReport* timings, RunTotals& totals) {
+    // Buffers + palette state reused from frame to frame
+    RetroFilterContext ctx(opt);
+    ctx.warmStart = warmStart;
 
-    cv::Mat samples;
-    bgr.convertTo(samples, CV_32F);
-    samples = samples.reshape(1, bgr.rows * bgr.cols); // Nx3
+    cv::Mat frame = first, outFrame;
+    for (int index = 0; ; ++index) {
+        // Apply GBA filter per frame
+        ctx.frameIndex = index;
+        {
+            TraceSpan span("filter", index);
+            gbaRetroFilter(frame, outFrame, ctx);
+        }
+        totals.compactness += ctx.stats.compactness;
+        totals.reference += ctx.stats.referenceCompactness;
+        if (timings) timings->add(index, ctx.timings);
 
-    cv::Mat labels, centers;
-    cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 1.0);
+        // Write frame
+        {
+            TraceSpan span("write", index);
+            writer.write(outFrame);
+        }
+        totals.frames++;
 
-    cv::kmeans(samples, K, labels, criteria, attempts, cv::KMEANS_PP_CENTERS, centers);
-    centers.convertTo(centers, CV_8U);
+        // Optional preview; ESC there stops early
+        if (preview) {
+            preview->post(frame, outFrame);
+            if (preview->stopRequested()) break;
+        }
 
-    cv::Mat out(bgr.rows * bgr.cols, 3, CV_8U);
-    for (int i = 0; i < labels.rows; ++i) {
-        int ci = labels.at<int>(i, 0);
-        out.at<uchar>(i, 0) = centers.at<uchar>(ci, 0);
-        out.at<uchar>(i, 1) = centers.at<uchar>(ci, 1);
-        out.at<uchar>(i, 2) = centers.at<uchar>(ci, 2);
+        TraceSpan span("decode", index + 1);
+        if (!cap.read(frame) || frame.empty()) break;
     }
-    return out.reshape(3, bgr.rows);
+
+    addContextTotals(ctx, totals);
 }
 
-// ---------------------- GBA filter ----------------------
-cv::Mat gbaRetroFilter(
-    const cv::Mat& inputBgr,
-    int targetWidth = 240,
-    int paletteColors = 16,
-    int ditherStrength = 18,
-    bool addEdgeHint = true
-) {
-    CV_Assert(inputBgr.type() == CV_8UC3);
-
-    cv::Mat bgr = inputBgr.clone();
-    const int H = bgr.rows;
-    const int W = bgr.cols;
-
-    // 1) Mild contrast via YCrCb luma scale
-    {
-        cv::Mat ycc;
-        cv::cvtColor(bgr, ycc, cv::COLOR_BGR2YCrCb);
-        std::vector<cv::Mat> ch;
-        cv::split(ycc, ch);
-        ch[0].convertTo(ch[0], -1, 1.10, 4.0);
-        cv::merge(ch, ycc);
-        cv::cvtColor(ycc, bgr, cv::COLOR_YCrCb2BGR);
+struct PipelineFrame {
+    int index = 0;
+    cv::Mat src;
+    cv::Mat out;
+};
+
+// Decoder (calling thread) -> N filter workers -> encoder thread, joined by
+// bounded queues. A FrameWindow stops the decoder while 4N frames are
+// decoded but not yet written, so that is also the most the encoder's
+// reorder buffer and the frame pool ever hold. Every worker owns its
+// RetroFilterContext, so warm start chains through every N-th frame. The
+// encoder parks frames that finish early and writes in decode order.
+static void runPipelined(cv::VideoCapture& cap, cv::Mat first, cv::VideoWriter& writer,
+                         const RetroFilterOptions& opt, bool warmStart, int workers,
+                         PreviewWindow* preview, TimingReport* timings, RunTotals& totals) {
+    const size_t depth = (size_t)workers * 2;
+    BoundedQueue<PipelineFrame> decoded(depth), filtered(depth);
+    FrameWindow window(workers * 4);
+    FramePool pool;
+    std::vector<RunTotals> workerTotals(workers);
+    std::atomic<int> activeWorkers{workers};
+
+    std::vector<std::thread> filters;
+    for (int w = 0; w < workers; ++w) {
+        try {
+            filters.emplace_back([&, w] {
+                if (TraceLog* log = TraceLog::active()) log->nameThread("filter " + std::to_string(w));
+                RetroFilterContext ctx(opt);
+                ctx.warmStart = warmStart;
+                RunTotals& t = workerTotals[w];
+
+                PipelineFrame f;
+                while (decoded.pop(f)) {
+                    f.out = pool.acquire();
+                    ctx.frameIndex = f.index;
+                    {
+                        TraceSpan span("filter", f.index);
+                        gbaRetroFilter(f.src, f.out, ctx);
+                    }
+                    t.compactness += ctx.stats.compactness;
+                    t.reference += ctx.stats.referenceCompactness;
+                    if (timings) timings->add(f.index, ctx.timings);
+                    TraceSpan span("queue_push", f.index);
+                    filtered.push(std::move(f));
+                }
+                addContextTotals(ctx, t);
+
+                // Last worker out ends the encoder's input
+                if (activeWorkers.fetch_sub(1) == 1) filtered.close();
+            });
+        } catch (const std::system_error& e) {
+            std::cerr << "Failed to create filter thread " << w << ": " << e.what() << "\n";
+            break;
+        }
+    }
+    const int missing = workers - (int)filters.size();
+    if (missing > 0 && activeWorkers.fetch_sub(missing) == missing) filtered.close();
+    if (filters.empty()) {
+        decoded.close();  // nothing will drain it
+        window.close();
+    }
+
+    std::thread encoder([&] {
+        if (TraceLog* log = TraceLog::active()) log->nameThread("encoder");
+        std::map<int, PipelineFrame> pending;
+        int next = 0;
+        PipelineFrame f;
+        while (filtered.pop(f)) {
+            pending.emplace(f.index, std::move(f));
+            for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+                {
+                    TraceSpan span("write", next);
+                    writer.write(it->second.out);
+                }
+                if (preview) preview->post(it->second.src, it->second.out);
+                pool.release(it->second.src);
+                pool.release(it->second.out);
+                pending.erase(it);
+            }
+            window.advance(next);
+        }
+        totals.frames = next;
+        window.close();
+    });
+
+    // Decoder runs on the calling thread
+    PipelineFrame f;
+    f.src = std::move(first);
+    for (int index = 0; ; ++index) {
+        f.index = index;
+        {
+            TraceSpan span("queue_push", index);
+            if (!decoded.push(std::move(f))) break;
+        }
+        f = PipelineFrame();
+        if (preview && preview->stopRequested()) break;
+        {
+            TraceSpan span("window_wait", index + 1);
+            if (!window.wait(index + 1)) break;
+        }
+        f.src = pool.acquire();
+        TraceSpan span("decode", index + 1);
+        if (!cap.read(f.src) || f.src.empty()) break;
     }
+    decoded.close();
 
-    // 2) Downscale
-    const float scale = float(targetWidth) / float(W);
-    const int targetHeight = std::max(1, int(std::lround(H * scale)));
+    for (std::thread& t : filters) t.join();
+    encoder.join();
 
-    cv::Mat small;
-    cv::resize(bgr, small, cv::Size(targetWidth, targetHeight), 0, 0, cv::INTER_AREA);
+    for (const RunTotals& t : workerTotals) {
+        totals.warmFits += t.warmFits;
+        totals.fullFits += t.fullFits;
+        totals.reusedFrames += t.reusedFrames;
+        totals.compactness += t.compactness;
+        totals.reference += t.reference;
+    }
+}
 
-    // 3) Edge hint
-    if (addEdgeHint) {
-        cv::Mat gray, edges;
-        cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
-        cv::Canny(gray, edges, 60, 140);
-        cv::dilate(edges, edges, cv::Mat(), cv::Point(-1, -1), 1);
+// ---------------------- Benchmark mode ----------------------
+// Decodes the clip into memory once, then runs gbaRetroFilter over it for
+// every width x colours x threads combination with no I/O in the loop.
+// `threads` filter workers (each with its own context) pull frames from
+// the in-memory clip; latency is the gbaRetroFilter time of one frame.
+// Decode and encode are timed separately, per frame.
+struct BenchmarkConfig {
+    std::vector<int> widths;
+    std::vector<int> colors;
+    std::vector<int> threads = {1};
+    int repeat = 3;           // passes over the clip per combination
+};
 
-        cv::Mat edgesBgr, halfEdges;
-        cv::cvtColor(edges, edgesBgr, cv::COLOR_GRAY2BGR);
-        edgesBgr.convertTo(halfEdges, CV_8U, 0.5);
-        cv::subtract(small, halfEdges, small);
+// "240,480,960" -> {240, 480, 960}; non-positive entries are dropped
+static std::vector<int> parseIntList(const std::string& text) {
+    std::vector<int> values;
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        const int v = std::atoi(text.substr(pos, end - pos).c_str());
+        if (v > 0) values.push_back(v);
+        pos = end + 1;
     }
+    return values;
+}
 
-    // 4) Dither (threaded into 4 regions)
-    small = applyOrderedDither(small, ditherStrength);
+// ---------------------- Resident memory ----------------------
+// The benchmark reports, per combination, how far the resident set rose
+// above what it was just before the combination started (the decoded clip
+// and earlier combinations excluded). Linux resets the high-water mark
+// through /proc/self/clear_refs and reads VmHWM/VmRSS; other platforms
+// cannot reset it, so there the figure is only the growth past the
+// process peak so far (0 if an earlier combination needed more).
+struct RssSample {
+    double current = 0.0;  // MiB
+    double peak = 0.0;     // MiB, since the last reset (or process start)
+};
 
-    // 5) Palette reduce
-    cv::Mat smallQ = kmeansQuantize(small, paletteColors, 3);
+#if defined(__linux__)
+// "VmHWM:  1234 kB" -> MiB, 0 if missing
+static double procStatusMiB(const std::string& key) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, key.size(), key) == 0) return std::atof(line.c_str() + key.size()) / 1024.0;
+    }
+    return 0.0;
+}
+#endif
+
+static RssSample sampleRss() {
+    RssSample s;
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        s.current = double(pmc.WorkingSetSize) / (1024.0 * 1024.0);
+        s.peak = double(pmc.PeakWorkingSetSize) / (1024.0 * 1024.0);
+    }
+#elif defined(__linux__)
+    s.current = procStatusMiB("VmRSS:");
+    s.peak = procStatusMiB("VmHWM:");
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        s.peak = double(usage.ru_maxrss) / (1024.0 * 1024.0);  // bytes
+#else
+        s.peak = double(usage.ru_maxrss) / 1024.0;             // KiB
+#endif
+    }
+    s.current = s.peak;  // no cheap current RSS: measure growth past the peak
+#endif
+    return s;
+}
 
-    // 6) Upscale back
-    cv::Mat out;
-    cv::resize(smallQ, out, cv::Size(W, H), 0, 0, cv::INTER_NEAREST);
+// Starts a measurement window; returns the baseline to subtract
+static double resetPeakRss() {
+#if defined(__linux__)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";  // reset VmHWM to the current RSS
+#endif
+    const RssSample s = sampleRss();
+#if defined(__linux__) || defined(_WIN32)
+    return s.current;
+#else
+    return s.peak;
+#endif
+}
 
-    // 7) Light sharpen
-    {
-        cv::Mat blurred;
-        cv::GaussianBlur(out, blurred, cv::Size(3, 3), 0);
-        cv::addWeighted(out, 1.15, blurred, -0.15, 0.0, out);
+static int runBenchmark(cv::VideoCapture& cap, const std::string& outputVid, double fps,
+                        const RetroFilterOptions& baseOpt, bool warmStart, BenchmarkConfig cfg) {
+    using Clock = std::chrono::steady_clock;
+    auto msSince = [](Clock::time_point t0) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    };
+
+    // 1) Decode once into memory
+    std::vector<cv::Mat> clip;
+    const Clock::time_point decodeStart = Clock::now();
+    for (;;) {
+        cv::Mat frame;
+        if (!cap.read(frame) || frame.empty()) break;
+        clip.push_back(frame);
+    }
+    const double decodeMs = msSince(decodeStart);
+    if (clip.empty()) {
+        std::cerr << "Error: no frames to benchmark\n";
+        return -1;
+    }
+    const int n = (int)clip.size();
+    std::cout << "Clip: " << n << " frames, " << clip[0].cols << "x" << clip[0].rows
+              << ", decode " << std::fixed << std::setprecision(3) << decodeMs / n << " ms/frame\n";
+
+    if (cfg.widths.empty()) cfg.widths.push_back(baseOpt.targetWidth);
+    if (cfg.colors.empty()) cfg.colors.push_back(baseOpt.paletteColors);
+
+    std::cout << std::setw(7) << "width" << std::setw(8) << "colors" << std::setw(9) << "threads"
+              << std::setw(9) << "frames" << std::setw(10) << "fps" << std::setw(12) << "fps/thread"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "p99 ms"
+              << std::setw(12) << "+peak MiB" << "\n";
+
+    // 2) Filter only, every combination
+    for (int width : cfg.widths) {
+        for (int colors : cfg.colors) {
+            for (int threads : cfg.threads) {
+                RetroFilterOptions opt = baseOpt;
+                opt.targetWidth = width;
+                opt.paletteColors = std::max(2, std::min(256, colors));
+
+                const int total = n * std::max(1, cfg.repeat);
+                std::atomic<int> next{0};
+                std::vector<std::vector<double>> latencies(threads);
+
+                auto work = [&](int w) {
+                    RetroFilterContext ctx(opt);
+                    ctx.warmStart = warmStart;
+                    cv::Mat out;
+                    latencies[w].reserve(total / threads + 1);
+                    int i;
+                    while ((i = next.fetch_add(1)) < total) {
+                        const Clock::time_point t0 = Clock::now();
+                        gbaRetroFilter(clip[i % n], out, ctx);
+                        latencies[w].push_back(msSince(t0));
+                    }
+                };
+
+                const double rssBase = resetPeakRss();
+                const Clock::time_point runStart = Clock::now();
+                std::vector<std::thread> helpers;
+                for (int w = 1; w < threads; ++w) helpers.emplace_back(work, w);
+                work(0);
+                for (std::thread& t : helpers) t.join();
+                const double wallMs = msSince(runStart);
+
+                std::vector<double> all;
+                for (const std::vector<double>& l : latencies) all.insert(all.end(), l.begin(), l.end());
+                std::sort(all.begin(), all.end());
+                const double rate = 1000.0 * total / wallMs;
+
+                std::cout << std::setw(7) << width << std::setw(8) << opt.paletteColors << std::setw(9) << threads
+                          << std::setw(9) << total << std::setprecision(2) << std::setw(10) << rate
+                          << std::setw(12) << rate / threads << std::setprecision(3)
+                          << std::setw(10) << percentileOf(all, 0.50) << std::setw(10) << percentileOf(all, 0.95)
+                          << std::setw(10) << percentileOf(all, 0.99) << std::setprecision(1)
+                          << std::setw(12) << std::max(0.0, sampleRss().peak - rssBase) << "\n";
+            }
+        }
     }
 
-    return out;
+    // 3) Encode only: filter once with the base options, then time the writes
+    std::vector<cv::Mat> filtered(n);
+    {
+        RetroFilterContext ctx(baseOpt);
+        ctx.warmStart = warmStart;
+        for (int i = 0; i < n; ++i) gbaRetroFilter(clip[i], filtered[i], ctx);
+    }
+    cv::VideoWriter writer;
+    const int fourcc = cv::VideoWriter::fourcc('m','p','4','v');
+    if (!writer.open(outputVid, fourcc, fps, clip[0].size(), true)) {
+        std::cerr << "Error: could not open VideoWriter: " << outputVid << "\n";
+        return -1;
+    }
+    const Clock::time_point encodeStart = Clock::now();
+    for (const cv::Mat& f : filtered) writer.write(f);
+    writer.release();
+    const double encodeMs = msSince(encodeStart);
+    std::cout << std::setprecision(3) << "Encode: " << encodeMs / n << " ms/frame (" << outputVid << ")\n";
+    return 0;
 }
 
 // ---------------------- GIF pipeline ----------------------
-int main() {
-    const std::string inputGif  = "silk_song.gif";
-    const std::string outputVid = "gba_output.mp4";
+// Usage:
+//   OpenCVExample [input.gif] [output.mp4] [options]
+//
+// --width N              internal (pixelated) width, default 240
+// --colors K             palette size, default 16
+// --dither N             ordered dither strength, 0 = off, default 18
+// --quantizer kmeans|histogram|subsample|rgb555
+//                        histogram = weighted k-means over a 5-bit colour
+//                        histogram; fast at 480-960 internal widths
+//                        subsample = fit on --samples pixels, assign all
+//                        rgb555 = fixed GBA 15-bit colour, no palette fit
+//                        (deterministic, no flicker; --dither 8 = 1 step)
+// --palette NAME|FILE    fixed palette instead of fitting one per frame:
+//                        gb, gbc, nes, pico8, cga, cga4, or a .gpl, .act
+//                        or .hex file (implies the fixed quantizer)
+// --low-res-contrast     downscale first, then apply the contrast at the
+//                        internal width (differs from the default order
+//                        only where clipped highlights are averaged)
+// --dmg                  Game Boy preset: single-channel luma pipeline with
+//                        4 fixed green shades (no palette fit)
+// --edge-hint canny|fast|off
+//                        canny = Canny + dilate (default); fast = one
+//                        Sobel-threshold pass, no hysteresis
+// --samples N            subsample: pixels used for fitting, default 6000
+// --validate-subsample   subsample: also fit every pixel and report the
+//                        compactness difference at the end (slow)
+// --no-warm-start        run full k-means++ (3 attempts) on every frame
+//                        instead of seeding each frame from the previous
+//                        frame's palette
+// --reuse-palette        map each frame through the previous palette's
+//                        lookup cube and only fit when that degrades
+//                        (needs warm start)
+// --pipeline N           decode, filter and encode concurrently with N
+//                        filter threads (0 = one per spare core); output
+//                        order is preserved
+// --preview              show the latest original/filtered frame on a
+//                        display thread (frames are dropped, never
+//                        waited for); ESC there stops early
+// --timings FILE         write per-stage filter timings (count, mean, p50,
+//                        p99 and one row per frame); JSON if FILE ends in
+//                        .json, CSV otherwise
+// --trace FILE           write a Chrome trace-event JSON of decode, filter
+//                        stages, dither bands, queue waits and writes
+// --benchmark            decode the clip into memory, then time the filter
+//                        alone (fps, p50/p95/p99 latency, RSS growth) and
+//                        decode/encode separately; see --bench-*
+// --bench-widths LIST    benchmark: internal widths, e.g. 240,480,960
+// --bench-colors LIST    benchmark: palette sizes, e.g. 8,16,32
+// --bench-threads LIST   benchmark: concurrent filter workers, e.g. 1,4,16
+// --bench-repeat N       benchmark: passes over the clip, default 3
+int main(int argc, char** argv) {
+    std::string inputGif  = "silk_song.gif";
+    std::string outputVid = "gba_output.mp4";
+    bool warmStart = true;
+    int pipelineWorkers = -1;  // < 0: serial loop
+    bool showPreview = false;
+    std::string timingsPath;
+    std::string tracePath;
+    bool benchmark = false;
+    BenchmarkConfig benchCfg;
+    RetroFilterOptions filterOpt;
+
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--no-warm-start") {
+            warmStart = false;
+        } else if (arg == "--reuse-palette") {
+            filterOpt.reusePalette = true;
+        } else if (arg == "--validate-subsample") {
+            filterOpt.validateSubsample = true;
+        } else if (arg == "--samples" && hasValue) {
+            filterOpt.subsampleCount = std::max(16, std::atoi(argv[++i]));
+        } else if (arg == "--width" && hasValue) {
+            filterOpt.targetWidth = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--colors" && hasValue) {
+            filterOpt.paletteColors = std::max(2, std::min(256, std::atoi(argv[++i])));
+        } else if (arg == "--palette" && hasValue) {
+            std::string error;
+            if (!loadPalette(argv[++i], filterOpt.fixedPalette, &error)) {
+                std::cerr << "Error: " << error << "\n";
+                return -1;
+            }
+            filterOpt.quantizer = QuantizeMode::Fixed;
+        } else if (arg == "--low-res-contrast") {
+            filterOpt.lowResContrast = true;
+        } else if (arg == "--dmg") {
+            filterOpt.dmg = true;
+        } else if (arg == "--edge-hint" && hasValue) {
+            const std::string mode = argv[++i];
+            filterOpt.addEdgeHint = mode != "off";
+            if (mode == "canny") {
+                filterOpt.edgeHintMode = EdgeHintMode::Canny;
+            } else if (mode == "fast") {
+                filterOpt.edgeHintMode = EdgeHintMode::Fast;
+            } else if (mode != "off") {
+                std::cerr << "Error: unknown edge hint mode: " << mode << "\n";
+                return -1;
+            }
+        } else if (arg == "--dither" && hasValue) {
+            filterOpt.ditherStrength = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--preview") {
+#ifdef RETRO_HEADLESS
+            std::cerr << "Error: --preview is not available in a RETRO_HEADLESS build\n";
+            return -1;
+#else
+            showPreview = true;
+#endif
+        } else if (arg == "--timings" && hasValue) {
+#if RETRO_STAGE_TIMERS
+            timingsPath = argv[++i];
+#else
+            std::cerr << "Error: --timings needs a build with RETRO_STAGE_TIMERS enabled\n";
+            return -1;
+#endif
+        } else if (arg == "--trace" && hasValue) {
+#if RETRO_STAGE_TIMERS
+            tracePath = argv[++i];
+#else
+            std::cerr << "Error: --trace needs a build with RETRO_STAGE_TIMERS enabled\n";
+            return -1;
+#endif
+        } else if (arg == "--benchmark") {
+            benchmark = true;
+        } else if (arg == "--bench-widths" && hasValue) {
+            benchCfg.widths = parseIntList(argv[++i]);
+        } else if (arg == "--bench-colors" && hasValue) {
+            benchCfg.colors = parseIntList(argv[++i]);
+        } else if (arg == "--bench-threads" && hasValue) {
+            benchCfg.threads = parseIntList(argv[++i]);
+            if (benchCfg.threads.empty()) benchCfg.threads.push_back(1);
+        } else if (arg == "--bench-repeat" && hasValue) {
+            benchCfg.repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--pipeline" && hasValue) {
+            pipelineWorkers = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--quantizer" && hasValue) {
+            const std::string q = argv[++i];
+            if (q == "kmeans") {
+                filterOpt.quantizer = QuantizeMode::KMeans;
+            } else if (q == "histogram") {
+                filterOpt.quantizer = QuantizeMode::Histogram;
+            } else if (q == "subsample") {
+                filterOpt.quantizer = QuantizeMode::Subsample;
+            } else if (q == "rgb555") {
+                filterOpt.quantizer = QuantizeMode::Rgb555;
+            } else {
+                std::cerr << "Error: unknown quantizer: " << q << "\n";
+                return -1;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Error: unknown option: " << arg << "\n";
+            return -1;
+        } else if (positional == 0) {
+            inputGif = arg;
+            positional++;
+        } else if (positional == 1) {
+            outputVid = arg;
+            positional++;
+        } else {
+            std::cerr << "Error: unexpected argument: " << arg << "\n";
+            return -1;
+        }
+    }
 
     cv::VideoCapture cap(inputGif);
     if (!cap.isOpened()) {
@@ -198,50 +875,78 @@ int main() {
     double fps = cap.get(cv::CAP_PROP_FPS);
     if (fps <= 0.0) fps = 15.0;
 
-    int width  = (int)cap.get(cv::CAP_PROP_FRAME_WIDTH);
-    int height = (int)cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+    if (benchmark) return runBenchmark(cap, outputVid, fps, filterOpt, warmStart, benchCfg);
 
-    // If GIF reports 0 size until first frame, we’ll initialize later
-    cv::VideoWriter writer;
-    bool writerReady = false;
+    // GIFs may report 0 size until the first frame, so size the writer from it
+    cv::Mat first;
+    if (!cap.read(first) || first.empty()) {
+        std::cerr << "Error: no frames in: " << inputGif << "\n";
+        return -1;
+    }
 
-    int frameIndex = 0;
-    cv::Mat frame;
+    // MP4 writer (OpenCV-only)
+    cv::VideoWriter writer;
+    int fourcc = cv::VideoWriter::fourcc('m','p','4','v');
+    if (!writer.open(outputVid, fourcc, fps, first.size(), true)) {
+        std::cerr << "Error: could not open VideoWriter: " << outputVid << "\n";
+        return -1;
+    }
 
-    while (true) {
-        if (!cap.read(frame) || frame.empty()) break;
+    std::unique_ptr<PreviewWindow> preview;
+    if (showPreview) preview.reset(new PreviewWindow());
 
-        // Initialize writer after first valid frame (robust for some GIFs)
-        if (!writerReady) {
-            width = frame.cols;
-            height = frame.rows;
+    // Installed before any worker thread starts so every thread sees it
+    TraceLog trace;
+    if (!tracePath.empty()) {
+        TraceLog::setActive(&trace);
+        trace.nameThread(pipelineWorkers < 0 ? "main" : "decoder");
+    }
 
-            // MP4 writer (OpenCV-only)
-            int fourcc = cv::VideoWriter::fourcc('m','p','4','v');
-            if (!writer.open(outputVid, fourcc, fps, cv::Size(width, height), true)) {
-                std::cerr << "Error: could not open VideoWriter: " << outputVid << "\n";
-                return -1;
-            }
-            writerReady = true;
+    TimingReport timings;
+    TimingReport* timingsOut = timingsPath.empty() ? nullptr : &timings;
+
+    RunTotals totals;
+    if (pipelineWorkers < 0) {
+        runSerial(cap, std::move(first), writer, filterOpt, warmStart, preview.get(), timingsOut, totals);
+    } else {
+        // Leave a core each for the decoder and encoder threads
+        if (pipelineWorkers == 0) {
+            const unsigned hw = std::thread::hardware_concurrency();
+            pipelineWorkers = hw > 3 ? (int)hw - 2 : 1;
         }
+        runPipelined(cap, std::move(first), writer, filterOpt, warmStart, pipelineWorkers,
+                     preview.get(), timingsOut, totals);
+    }
 
-        // Apply GBA filter per frame
-        cv::Mat outFrame = gbaRetroFilter(frame, 240, 16, 18, true);
-
-        // Write frame
-        writer.write(outFrame);
-
-        // Optional preview
-        cv::imshow("GIF Frame (Original)", frame);
-        cv::imshow("GIF Frame (GBA)", outFrame);
-
-        // Press ESC to stop early
-        int key = cv::waitKey(1);
-        if (key == 27) break;
+    TraceLog::setActive(nullptr);
 
-        frameIndex++;
+    std::cout << "Done. Wrote " << totals.frames << " frames: " << outputVid << "\n";
+    if (!tracePath.empty()) {
+        if (trace.write(tracePath)) {
+            std::cout << "Trace: " << tracePath << "\n";
+        } else {
+            std::cerr << "Error: could not write trace: " << tracePath << "\n";
+        }
+    }
+    if (timingsOut) {
+        if (timings.write(timingsPath)) {
+            std::cout << "Stage timings: " << timingsPath << "\n";
+        } else {
+            std::cerr << "Error: could not write timings: " << timingsPath << "\n";
+        }
+    }
+    const bool fitsPalette = filterOpt.quantizer != QuantizeMode::Rgb555
+                          && filterOpt.quantizer != QuantizeMode::Fixed && !filterOpt.dmg;
+    if (warmStart && fitsPalette) {
+        std::cout << "K-means: " << totals.warmFits << " warm-started frames, "
+                  << totals.fullFits << " full refits";
+        if (filterOpt.reusePalette) std::cout << ", " << totals.reusedFrames << " frames on the previous palette";
+        std::cout << "\n";
+    }
+    if (filterOpt.quantizer == QuantizeMode::Subsample && filterOpt.validateSubsample && totals.reference > 0.0) {
+        std::cout << "Subsample fit compactness: " << totals.compactness
+                  << " vs full fit: " << totals.reference
+                  << " (" << 100.0 * (totals.compactness - totals.reference) / totals.reference << "%)\n";
     }
-
-    std::cout << "Done. Wrote video: " << outputVid << "\n";
     return 0;
 }
@@ -0,0 +1,154 @@
+// reference_v1.hpp - the single-threaded version 1 filter, stage by stage,
+// kept as the baseline retro_bench compares against. The code matches
+// "version_1 - No_threading/main.cpp"; only the inline stage blocks of its
+// gbaRetroFilter were split into functions. Do not optimise this file.
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace retro_v1 {
+
+static const int BAYER8[8][8] = {
+    { 0, 48, 12, 60,  3, 51, 15, 63},
+    {32, 16, 44, 28, 35, 19, 47, 31},
+    { 8, 56,  4, 52, 11, 59,  7, 55},
+    {40, 24, 36, 20, 43, 27, 39, 23},
+    { 2, 50, 14, 62,  1, 49, 13, 61},
+    {34, 18, 46, 30, 33, 17, 45, 29},
+    {10, 58,  6, 54,  9, 57,  5, 53},
+    {42, 26, 38, 22, 41, 25, 37, 21}
+};
+
+static inline uchar clampU8(int v) {
+    return (uchar)std::max(0, std::min(255, v));
+}
+
+// 1) Mild contrast punch via YCrCb luma scaling
+inline cv::Mat contrast(const cv::Mat& inputBgr) {
+    cv::Mat bgr = inputBgr.clone();
+    cv::Mat ycc;
+    cv::cvtColor(bgr, ycc, cv::COLOR_BGR2YCrCb);
+    std::vector<cv::Mat> ch;
+    cv::split(ycc, ch);
+    ch[0].convertTo(ch[0], -1, 1.10, 4.0);
+    cv::merge(ch, ycc);
+    cv::cvtColor(ycc, bgr, cv::COLOR_YCrCb2BGR);
+    return bgr;
+}
+
+// 2) Downscale for pixelation base
+inline cv::Mat downscale(const cv::Mat& bgr, int targetWidth) {
+    const float scale = float(targetWidth) / float(bgr.cols);
+    const int targetHeight = std::max(1, int(std::lround(bgr.rows * scale)));
+    cv::Mat small;
+    cv::resize(bgr, small, cv::Size(targetWidth, targetHeight), 0, 0, cv::INTER_AREA);
+    return small;
+}
+
+// 3) Edge hint, in place
+inline void edgeHint(cv::Mat& small) {
+    cv::Mat gray, edges;
+    cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    cv::Canny(gray, edges, 60, 140);
+    cv::dilate(edges, edges, cv::Mat(), cv::Point(-1, -1), 1);
+
+    cv::Mat edgesBgr;
+    cv::cvtColor(edges, edgesBgr, cv::COLOR_GRAY2BGR);
+
+    cv::Mat halfEdges;
+    edgesBgr.convertTo(halfEdges, CV_8U, 0.5); // 0 or ~127
+    cv::subtract(small, halfEdges, small);
+}
+
+// 4) Ordered dithering (scalar, per-pixel lround)
+inline cv::Mat applyOrderedDither(const cv::Mat& bgr, int strength) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    if (strength <= 0) return bgr.clone();
+
+    cv::Mat out = bgr.clone();
+    const int h = out.rows;
+    const int w = out.cols;
+
+    for (int y = 0; y < h; ++y) {
+        const int by = y & 7;
+        for (int x = 0; x < w; ++x) {
+            const int bx = x & 7;
+            const int t = BAYER8[by][bx]; // 0..63
+
+            const float norm = (float(t) - 31.5f) / 63.0f;
+            const int offset = (int)std::lround(norm * float(strength));
+
+            cv::Vec3b& p = out.at<cv::Vec3b>(y, x);
+            p[0] = clampU8(int(p[0]) + offset);
+            p[1] = clampU8(int(p[1]) + offset);
+            p[2] = clampU8(int(p[2]) + offset);
+        }
+    }
+    return out;
+}
+
+// 5) Palette reduction via k-means
+inline cv::Mat kmeansQuantize(const cv::Mat& bgr, int K, int attempts = 3) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    CV_Assert(K >= 2);
+
+    cv::Mat samples;
+    bgr.convertTo(samples, CV_32F);
+    samples = samples.reshape(1, bgr.rows * bgr.cols);
+
+    cv::Mat labels, centers;
+
+    cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 1.0);
+    cv::kmeans(samples, K, labels, criteria, attempts, cv::KMEANS_PP_CENTERS, centers);
+
+    centers.convertTo(centers, CV_8U);
+
+    cv::Mat out(bgr.rows * bgr.cols, 3, CV_8U);
+    for (int i = 0; i < labels.rows; ++i) {
+        int ci = labels.at<int>(i, 0);
+        out.at<uchar>(i, 0) = centers.at<uchar>(ci, 0);
+        out.at<uchar>(i, 1) = centers.at<uchar>(ci, 1);
+        out.at<uchar>(i, 2) = centers.at<uchar>(ci, 2);
+    }
+
+    out = out.reshape(3, bgr.rows);
+    return out;
+}
+
+// 6) Nearest-neighbor upscale back to original size
+inline cv::Mat upscale(const cv::Mat& smallQ, cv::Size size) {
+    cv::Mat out;
+    cv::resize(smallQ, out, size, 0, 0, cv::INTER_NEAREST);
+    return out;
+}
+
+// 7) Light sharpen (unsharp mask style), in place
+inline void sharpen(cv::Mat& out) {
+    cv::Mat blurred;
+    cv::GaussianBlur(out, blurred, cv::Size(3, 3), 0);
+    cv::addWeighted(out, 1.15, blurred, -0.15, 0.0, out);
+}
+
+inline cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    int targetWidth = 240,
+    int paletteColors = 16,
+    int ditherStrength = 18,
+    bool addEdgeHint = true
+) {
+    CV_Assert(inputBgr.type() == CV_8UC3);
+
+    cv::Mat bgr = contrast(inputBgr);
+    cv::Mat small = downscale(bgr, targetWidth);
+    if (addEdgeHint) edgeHint(small);
+    small = applyOrderedDither(small, ditherStrength);
+    cv::Mat out = upscale(kmeansQuantize(small, paletteColors, 3), inputBgr.size());
+    sharpen(out);
+    return out;
+}
+
+} // namespace retro_v1
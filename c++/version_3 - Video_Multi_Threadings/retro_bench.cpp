@@ -0,0 +1,717 @@
+// retro_bench.cpp - per-stage microbenchmarks for the GBA filter
+//
+// Runs every gbaRetroFilter stage in isolation over a generated, fully
+// deterministic corpus (gradient, noise and photo-like images at 240p to
+// 4K) and reports the median time per call as ns/pixel and GB/s, next to
+// the version 1 scalar code (reference_v1.hpp) on the same input.
+//
+// Usage:
+//   retro_bench [--quick] [--min-time SEC] [--width N] [--csv FILE]
+//   retro_bench --validate [--quick]
+//
+// --quick         240p and 1080p only, gradient and photo only
+// --min-time SEC  time spent per measurement, default 0.25
+// --width N       internal width for the quantizer inputs, default 240
+// --csv FILE      also write every row as CSV
+// --validate      instead of timing, check the fused stages against the
+//                 version 1 code: every one of the 2^24 colours plus the
+//                 corpus; exits 1 if a stage is outside its bound
+//
+// Contrast, downscale, upscale, sharpen, edge hint and dither run at the
+// corpus resolution (they are per-pixel kernels, so this also shows how
+// dithering scales with threads). The quantizers run on the corpus image
+// downscaled to --width, which is what they see inside the filter.
+#include "retro_filter.hpp"
+#include "reference_v1.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+// ---------------------- Synthetic corpus ----------------------
+// Every image is a pure function of (kind, size), so runs are comparable
+// across machines and commits.
+enum class CorpusKind { Gradient, Noise, Photo };
+
+static const char* corpusName(CorpusKind k) {
+    switch (k) {
+    case CorpusKind::Gradient: return "gradient";
+    case CorpusKind::Noise:    return "noise";
+    case CorpusKind::Photo:    return "photo";
+    }
+    return "?";
+}
+
+struct CorpusSize {
+    const char* name;
+    int width, height;
+};
+
+static const CorpusSize CORPUS_SIZES[] = {
+    {"240p", 426, 240}, {"480p", 854, 480}, {"720p", 1280, 720},
+    {"1080p", 1920, 1080}, {"4K", 3840, 2160}
+};
+
+static cv::Mat makeCorpusImage(CorpusKind kind, cv::Size size) {
+    cv::Mat img(size, CV_8UC3);
+    cv::RNG rng(0xC0FFEEu + (unsigned)size.width * 31u + (unsigned)kind);
+
+    switch (kind) {
+    case CorpusKind::Gradient:
+        // Smooth ramps on every channel: worst case for banding/dithering
+        for (int y = 0; y < size.height; ++y) {
+            cv::Vec3b* row = img.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < size.width; ++x) {
+                row[x] = cv::Vec3b((uchar)(x * 255 / std::max(1, size.width - 1)),
+                                   (uchar)(y * 255 / std::max(1, size.height - 1)),
+                                   (uchar)((x + y) * 255 / std::max(1, size.width + size.height - 2)));
+            }
+        }
+        break;
+    case CorpusKind::Noise:
+        // Uniform noise: every colour occupied, no spatial coherence
+        rng.fill(img, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+        break;
+    case CorpusKind::Photo: {
+        // Low-frequency colour field + hard-edged shapes + sensor noise
+        cv::Mat coarse(std::max(2, size.height / 64), std::max(2, size.width / 64), CV_8UC3);
+        rng.fill(coarse, cv::RNG::UNIFORM, cv::Scalar::all(30), cv::Scalar::all(226));
+        cv::resize(coarse, img, size, 0, 0, cv::INTER_CUBIC);
+        const int scale = std::max(1, size.width / 64);
+        for (int i = 0; i < 24; ++i) {
+            const cv::Point c(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            const cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+            if (i & 1) {
+                cv::circle(img, c, rng.uniform(scale, 6 * scale), color, cv::FILLED, cv::LINE_AA);
+            } else {
+                const cv::Point d(c.x + rng.uniform(scale, 8 * scale), c.y + rng.uniform(scale, 8 * scale));
+                cv::rectangle(img, c, d, color, cv::FILLED);
+            }
+        }
+        cv::Mat noise(size, CV_8UC3);
+        rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(6));
+        cv::add(img, noise, img);
+        break;
+    }
+    }
+    return img;
+}
+
+// ---------------------- Allocation counter ----------------------
+// Every operator new in the process (std::vector, std::function, ...).
+// cv::Mat data comes from cv::fastMalloc and is not counted here.
+static std::atomic<long long> g_allocations{0};
+
+void* operator new(std::size_t n) {
+    g_allocations++;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// ---------------------- Timing ----------------------
+// Median wall time of fn() in ns. One untimed call first (allocations,
+// palette cubes, pool start-up), then repeats for at least minSeconds and
+// at least 3 calls.
+template <typename Fn>
+static double medianNs(const Fn& fn, double minSeconds) {
+    using Clock = std::chrono::steady_clock;
+    fn();
+
+    std::vector<double> samples;
+    const Clock::time_point start = Clock::now();
+    do {
+        const Clock::time_point t0 = Clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count());
+    } while (samples.size() < 3 ||
+             (std::chrono::duration<double>(Clock::now() - start).count() < minSeconds && samples.size() < 10000));
+
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+// ---------------------- Report ----------------------
+struct BenchRow {
+    std::string corpus, size, stage, variant;
+    double pixels;       // pixels processed per call
+    double bytes;        // bytes read + written per call (estimate)
+    double ns;           // median per call
+    double v1Ns;         // version 1 time for the same stage/input, 0 if none
+};
+
+class BenchReport {
+public:
+    explicit BenchReport(double minSeconds) : minSeconds(minSeconds) {
+        std::cout << std::left << std::setw(10) << "corpus" << std::setw(7) << "size"
+                  << std::setw(16) << "stage" << std::setw(14) << "variant" << std::right
+                  << std::setw(12) << "ms/call" << std::setw(10) << "ns/px"
+                  << std::setw(9) << "GB/s" << std::setw(9) << "vs v1" << "\n";
+    }
+
+    // Times fn and prints one row; returns the median ns per call
+    template <typename Fn>
+    double run(const std::string& corpus, const std::string& size, const std::string& stage,
+               const std::string& variant, double pixels, double bytes, double v1Ns, const Fn& fn) {
+        BenchRow r = { corpus, size, stage, variant, pixels, bytes, medianNs(fn, minSeconds), v1Ns };
+        print(r);
+        rows.push_back(r);
+        return r.ns;
+    }
+
+    bool writeCsv(const std::string& path) const {
+        std::ofstream f(path);
+        if (!f) return false;
+        f << "corpus,size,stage,variant,pixels,ms_per_call,ns_per_pixel,gb_per_s,speedup_vs_v1\n";
+        for (const BenchRow& r : rows) {
+            f << r.corpus << "," << r.size << "," << r.stage << "," << r.variant << ","
+              << (long long)r.pixels << "," << r.ns * 1e-6 << "," << r.ns / r.pixels << ","
+              << r.bytes / r.ns << "," << (r.v1Ns > 0.0 ? r.v1Ns / r.ns : 0.0) << "\n";
+        }
+        return bool(f);
+    }
+
+private:
+    static void print(const BenchRow& r) {
+        std::cout << std::left << std::setw(10) << r.corpus << std::setw(7) << r.size
+                  << std::setw(16) << r.stage << std::setw(14) << r.variant << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(12) << r.ns * 1e-6
+                  << std::setprecision(2) << std::setw(10) << r.ns / r.pixels
+                  << std::setw(9) << r.bytes / r.ns;  // bytes per ns == GB/s
+        if (r.v1Ns > 0.0) std::cout << std::setw(8) << r.v1Ns / r.ns << "x";
+        std::cout << "\n";
+    }
+
+    double minSeconds;
+    std::vector<BenchRow> rows;
+};
+
+// ---------------------- Stage benchmarks ----------------------
+static void benchImage(BenchReport& report, const std::string& corpus, const CorpusSize& cs,
+                       const cv::Mat& img, int internalWidth) {
+    const std::string size = cs.name;
+    const double px = double(img.total());
+    const double rw = px * 6.0;  // 3 bytes in + 3 bytes out per pixel
+
+    RetroFilterOptions opt;
+    opt.targetWidth = internalWidth;
+    RetroFilterContext ctx(opt);
+    cv::Mat out, small, work;
+
+    // 1) contrast
+    double v1 = report.run(corpus, size, "contrast", "v1", px, rw, 0.0, [&] {
+        out = retro_v1::contrast(img);
+    });
+    report.run(corpus, size, "contrast", "v3", px, rw, v1, [&] {
+        contrastStage(img, out);
+    });
+
+    // 2) downscale (reads full res, writes internal res)
+    const double smallPx = double(internalWidth) * std::max(1.0, std::round(img.rows * double(internalWidth) / img.cols));
+    v1 = report.run(corpus, size, "downscale", "v1", px, px * 3.0 + smallPx * 3.0, 0.0, [&] {
+        small = retro_v1::downscale(img, internalWidth);
+    });
+    report.run(corpus, size, "downscale", "v3", px, px * 3.0 + smallPx * 3.0, v1, [&] {
+        downscaleStage(img, small, internalWidth);
+    });
+
+    // 3) edge hint (in place; repeated darkening does not change the cost)
+    img.copyTo(work);
+    v1 = report.run(corpus, size, "edge_hint", "v1", px, rw, 0.0, [&] {
+        retro_v1::edgeHint(work);
+    });
+    img.copyTo(work);
+    report.run(corpus, size, "edge_hint", "v3", px, rw, v1, [&] {
+        edgeHintStage(work, ctx);
+    });
+    img.copyTo(work);
+    report.run(corpus, size, "edge_hint", "v3 fast", px, rw, v1, [&] {
+        edgeHintFastStage(work, ctx);
+    });
+
+    // 4) dither at 1/2/4/all threads
+    const int strength = opt.ditherStrength;
+    v1 = report.run(corpus, size, "dither", "v1 scalar", px, rw, 0.0, [&] {
+        out = retro_v1::applyOrderedDither(img, strength);
+    });
+    const int allThreads = workerPool().size() + 1;
+    std::vector<int> threadCounts = {1, 2, 4};
+    threadCounts.erase(std::remove_if(threadCounts.begin(), threadCounts.end(),
+                                      [&](int t) { return t >= allThreads; }), threadCounts.end());
+    threadCounts.push_back(allThreads);
+    DitherRows rows;
+    for (int t : threadCounts) {
+        report.run(corpus, size, "dither", "v3 t=" + std::to_string(t), px, rw, v1, [&] {
+            applyOrderedDitherInto(img, out, strength, rows, -1, t);
+        });
+    }
+
+    // 5) palette reduction on the internal-resolution image
+    downscaleStage(img, small, internalWidth);
+    const double qpx = double(small.total());
+    for (int K : {4, 16, 32}) {
+        const std::string stage = "quantize K=" + std::to_string(K);
+        v1 = report.run(corpus, size, stage, "v1 kmeans", qpx, qpx * 6.0, 0.0, [&] {
+            out = retro_v1::kmeansQuantize(small, K, opt.kmeansAttempts);
+        });
+        report.run(corpus, size, stage, "kmeans", qpx, qpx * 6.0, v1, [&] {
+            out = kmeansQuantize(small, K, opt.kmeansAttempts);
+        });
+        report.run(corpus, size, stage, "histogram", qpx, qpx * 6.0, v1, [&] {
+            out = histogramQuantize(small, K, opt.histogramBits, opt.kmeansAttempts);
+        });
+        report.run(corpus, size, stage, "subsample", qpx, qpx * 6.0, v1, [&] {
+            out = subsampleQuantize(small, K, opt.subsampleCount, opt.kmeansAttempts);
+        });
+    }
+    // Fixed console palettes through the nearest-colour cube (built once,
+    // outside the timing), against v1 k-means at the same K
+    for (const char* name : {"pico8", "nes"}) {
+        cv::Mat palette;
+        loadPalette(name, palette);
+        PaletteLUT lut(6);
+        lut.update(palette);
+        const std::string stage = std::string("palette ") + name;
+        v1 = report.run(corpus, size, stage, "v1 kmeans", qpx, qpx * 6.0, 0.0, [&] {
+            out = retro_v1::kmeansQuantize(small, palette.rows, opt.kmeansAttempts);
+        });
+        report.run(corpus, size, stage, "fixed lut", qpx, qpx * 6.0, v1, [&] {
+            lut.apply(small, out);
+        });
+    }
+
+    // Fixed RGB555 (dither + 5-bit snap in one pass) against the v1 dither
+    // and k-means it replaces
+    v1 = report.run(corpus, size, "dither+palette", "v1 kmeans", qpx, qpx * 6.0, 0.0, [&] {
+        out = retro_v1::kmeansQuantize(retro_v1::applyOrderedDither(small, strength),
+                                       opt.paletteColors, opt.kmeansAttempts);
+    });
+    report.run(corpus, size, "dither+palette", "rgb555", qpx, qpx * 6.0, v1, [&] {
+        ditherRgb555Into(small, out, strength, rows);
+    });
+    cv::Mat palette, indices;
+    const cv::Mat smallQ = kmeansQuantize(small, opt.paletteColors, opt.kmeansAttempts, &palette);
+    PaletteLUT paletteLut(6);
+    paletteLut.update(palette);
+    paletteLut.applyIndices(small, indices);
+
+    // The fitted palette applied again at full resolution through the cube
+    // (what --reuse-palette does per frame, at the internal width), against
+    // one cv::LUT pass over the same image
+    cv::Mat identity(1, 256, CV_8U);
+    for (int i = 0; i < 256; ++i) identity.ptr<uchar>(0)[i] = uchar(i);
+    const double lutNs = report.run(corpus, size, "palette reuse", "cv::LUT", px, rw, 0.0, [&] {
+        cv::LUT(img, identity, out);
+    });
+    report.run(corpus, size, "palette reuse", "cube", px, rw, lutNs, [&] {
+        out = quantizeToPalette(img, palette, paletteLut);
+    });
+
+    // 6) upscale (reads internal res, writes full res)
+    v1 = report.run(corpus, size, "upscale", "v1", px, qpx * 3.0 + px * 3.0, 0.0, [&] {
+        out = retro_v1::upscale(smallQ, img.size());
+    });
+    report.run(corpus, size, "upscale", "v3", px, qpx * 3.0 + px * 3.0, v1, [&] {
+        upscaleStage(smallQ, out, img.size(), ctx);
+    });
+
+    // 7) sharpen (in place)
+    img.copyTo(work);
+    v1 = report.run(corpus, size, "sharpen", "v1", px, rw, 0.0, [&] {
+        retro_v1::sharpen(work);
+    });
+    img.copyTo(work);
+    report.run(corpus, size, "sharpen", "v3", px, rw, v1, [&] {
+        sharpenStage(work, ctx);
+    });
+
+    // 6+7) fused, against the two v1 passes
+    v1 = report.run(corpus, size, "upscale+sharpen", "v1", px, qpx * 3.0 + px * 3.0, 0.0, [&] {
+        out = retro_v1::upscale(smallQ, img.size());
+        retro_v1::sharpen(out);
+    });
+    report.run(corpus, size, "upscale+sharpen", "v3 fused", px, qpx * 3.0 + px * 3.0, v1, [&] {
+        upscaleSharpenStage(smallQ, out, img.size(), ctx);
+    });
+    report.run(corpus, size, "upscale+sharpen", "v3 indexed", px, qpx + px * 3.0, v1, [&] {
+        upscaleSharpenIndexedStage(indices, palette, out, img.size(), ctx);
+    });
+
+    // Whole filter, default options
+    v1 = report.run(corpus, size, "filter", "v1", px, rw, 0.0, [&] {
+        out = retro_v1::gbaRetroFilter(img, internalWidth);
+    });
+    report.run(corpus, size, "filter", "v3", px, rw, v1, [&] {
+        gbaRetroFilter(img, out, ctx);
+    });
+    RetroFilterOptions lowResOpt = opt;
+    lowResOpt.lowResContrast = true;
+    RetroFilterContext lowResCtx(lowResOpt);
+    report.run(corpus, size, "filter", "v3 low-res", px, rw, v1, [&] {
+        gbaRetroFilter(img, out, lowResCtx);
+    });
+    RetroFilterOptions fastEdgeOpt = opt;
+    fastEdgeOpt.edgeHintMode = EdgeHintMode::Fast;
+    RetroFilterContext fastEdgeCtx(fastEdgeOpt);
+    report.run(corpus, size, "filter", "v3 fast edge", px, rw, v1, [&] {
+        gbaRetroFilter(img, out, fastEdgeCtx);
+    });
+    RetroFilterOptions dmgOpt = opt;
+    dmgOpt.dmg = true;
+    RetroFilterContext dmgCtx(dmgOpt);
+    report.run(corpus, size, "filter", "v3 dmg", px, rw, v1, [&] {
+        gbaRetroFilter(img, out, dmgCtx);
+    });
+}
+
+// ---------------------- Validation ----------------------
+// Largest per-byte difference between two CV_8UC3 images, and how many
+// bytes differ at all
+struct DiffStats {
+    int maxDiff = 0;
+    double differing = 0.0;
+    double sumDiff = 0.0;
+    double total = 0.0;
+
+    void add(const cv::Mat& a, const cv::Mat& b) {
+        CV_Assert(a.size() == b.size() && a.type() == b.type());
+        cv::Mat diff;
+        cv::absdiff(a, b, diff);
+        double maxVal = 0.0;
+        cv::minMaxLoc(diff.reshape(1), nullptr, &maxVal);
+        maxDiff = std::max(maxDiff, int(maxVal));
+        differing += double(cv::countNonZero(diff.reshape(1)));
+        sumDiff += cv::sum(diff.reshape(1))[0];
+        total += double(diff.total() * diff.channels());
+    }
+};
+
+// Every 24-bit colour once: a 4096x4096 image with B, G, R = the low,
+// middle and high byte of the pixel index
+static cv::Mat makeAllColours() {
+    cv::Mat img(4096, 4096, CV_8UC3);
+    for (int y = 0; y < img.rows; ++y) {
+        uchar* p = img.ptr<uchar>(y);
+        for (int x = 0; x < img.cols; ++x, p += 3) {
+            const int i = y * img.cols + x;
+            p[0] = uchar(i);
+            p[1] = uchar(i >> 8);
+            p[2] = uchar(i >> 16);
+        }
+    }
+    return img;
+}
+
+// Scalar RGB555 reference, written from the header's definition rather
+// than the kernel: dither as v1 does, then c5 = the nearest 5-bit level and
+// out = c5 << 3 | c5 >> 2
+static cv::Mat rgb555Reference(const cv::Mat& bgr, int strength) {
+    cv::Mat out = retro_v1::applyOrderedDither(bgr, strength);
+    for (int y = 0; y < out.rows; ++y) {
+        uchar* p = out.ptr<uchar>(y);
+        for (int i = 0; i < out.cols * 3; ++i) {
+            const int c5 = std::min(31, (int(p[i]) + 4) >> 3);
+            p[i] = uchar((c5 << 3) | (c5 >> 2));
+        }
+    }
+    return out;
+}
+
+// Mean and largest extra distance of the colour a PaletteLUT picks over the
+// exact nearest palette colour, and how many pixels get another colour
+struct LutError {
+    double differing = 0.0;
+    double sumExcess = 0.0;
+    double maxExcess = 0.0;
+    double total = 0.0;
+
+    void add(const cv::Mat& bgr, const cv::Mat& mapped, const cv::Mat& palette) {
+        CV_Assert(bgr.size() == mapped.size() && bgr.type() == CV_8UC3 && mapped.type() == CV_8UC3);
+        for (int y = 0; y < bgr.rows; ++y) {
+            const uchar* s = bgr.ptr<uchar>(y);
+            const uchar* m = mapped.ptr<uchar>(y);
+            for (int x = 0; x < bgr.cols; ++x, s += 3, m += 3) {
+                auto dist = [&](const uchar* c) {
+                    const int db = s[0] - c[0], dg = s[1] - c[1], dr = s[2] - c[2];
+                    return std::sqrt(double(db * db + dg * dg + dr * dr));
+                };
+                double best = DBL_MAX;
+                for (int k = 0; k < palette.rows; ++k) best = std::min(best, dist(palette.ptr<uchar>(k)));
+                const double excess = dist(m) - best;
+                differing += excess > 0.0;
+                sumExcess += excess;
+                maxExcess = std::max(maxExcess, excess);
+            }
+        }
+        total += double(bgr.total());
+    }
+};
+
+static bool reportDiff(const char* stage, const DiffStats& d, int bound) {
+    const bool ok = d.maxDiff <= bound;
+    std::cout << std::left << std::setw(12) << stage << std::right << "max |diff| " << d.maxDiff
+              << " (bound " << bound << "), mean " << std::fixed << std::setprecision(3)
+              << d.sumDiff / std::max(1.0, d.total) << ", "
+              << 100.0 * d.differing / std::max(1.0, d.total) << "% of bytes differ  "
+              << (ok ? "ok" : "FAIL") << "\n";
+    return ok;
+}
+
+static int runValidation(bool quick, int internalWidth) {
+    std::vector<cv::Mat> inputs = { makeAllColours() };
+    for (CorpusKind kind : {CorpusKind::Gradient, CorpusKind::Noise, CorpusKind::Photo}) {
+        for (const CorpusSize& cs : CORPUS_SIZES) {
+            if (quick && std::string(cs.name) != "240p") continue;
+            inputs.push_back(makeCorpusImage(kind, cv::Size(cs.width, cs.height)));
+        }
+    }
+
+    // 1) fused contrast vs the YCrCb round trip: within 1 LSB
+    DiffStats contrast;
+    cv::Mat out;
+    for (const cv::Mat& img : inputs) {
+        contrastStage(img, out);
+        contrast.add(retro_v1::contrast(img), out);
+    }
+
+    // 2) contrast after the downscale vs before it, at the internal width
+    // (the corpus only; 4096x4096 of unrelated neighbours is not an image)
+    DiffStats lowRes;
+    cv::Mat bgr, small, smallLowRes;
+    for (size_t i = 1; i < inputs.size(); ++i) {
+        contrastStage(inputs[i], bgr);
+        downscaleStage(bgr, small, internalWidth);
+        downscaleStage(inputs[i], smallLowRes, internalWidth);
+        contrastStage(smallLowRes, smallLowRes);
+        lowRes.add(small, smallLowRes);
+    }
+
+    // 3) upscale vs cv::resize, the fused upscale + sharpen vs the two v1
+    // passes (BGR and one channel) and the index-domain form vs the fused
+    // one on the expanded image: all bit-exact. Each image is upscaled to
+    // the corpus size and to integer factors of the small one (the
+    // replication path).
+    DiffStats upscale, upSharpen, indexed;
+    RetroFilterContext ws;
+    cv::Mat ref, fused, gray, grayQ, palette, indices, expanded;
+    PaletteLUT lut(6);
+    for (size_t i = 1; i < inputs.size(); ++i) {
+        downscaleStage(inputs[i], small, internalWidth);
+        const cv::Mat smallQ = kmeansQuantize(small, 16, 3, &palette);
+        cv::cvtColor(smallQ, grayQ, cv::COLOR_BGR2GRAY);
+        lut.update(palette);
+        lut.applyIndices(small, indices);
+        expandPalette(indices, palette, expanded);
+        for (int factor : {0, 2, 3, 4, 8}) {
+            const cv::Size size = factor ? cv::Size(smallQ.cols * factor, smallQ.rows * factor) : inputs[i].size();
+            upscaleStage(smallQ, fused, size, ws);
+            upscale.add(retro_v1::upscale(smallQ, size), fused);
+
+            ref = retro_v1::upscale(smallQ, size);
+            retro_v1::sharpen(ref);
+            upscaleSharpenStage(smallQ, fused, size, ws);
+            upSharpen.add(ref, fused);
+
+            gray = retro_v1::upscale(grayQ, size);
+            retro_v1::sharpen(gray);
+            cv::cvtColor(gray, ref, cv::COLOR_GRAY2BGR);
+            upscaleSharpenStage(grayQ, gray, size, ws);
+            cv::cvtColor(gray, fused, cv::COLOR_GRAY2BGR);
+            upSharpen.add(ref, fused);
+
+            upscaleSharpenStage(expanded, ref, size, ws);
+            upscaleSharpenIndexedStage(indices, palette, fused, size, ws);
+            indexed.add(ref, fused);
+        }
+    }
+
+    // 4) vectorised ordered dither vs the v1 per-pixel loop: bit-exact. Adds
+    // crops whose row length is not a multiple of the vector width (so the
+    // scalar tail runs) and 1-3 pixel images (fewer rows than bands)
+    std::vector<cv::Mat> ditherInputs = inputs;
+    const cv::Mat& colours = inputs[0];
+    for (int w : {1, 2, 3, 5, 7, 11, 15, 17, 31, 33, 63, 65, 127, 129}) {
+        ditherInputs.push_back(colours(cv::Rect(w, 3, w, 9)));
+    }
+    for (const cv::Size& tiny : {cv::Size(1, 1), cv::Size(2, 1), cv::Size(1, 3), cv::Size(3, 1)}) {
+        ditherInputs.push_back(colours(cv::Rect(5, 7, tiny.width, tiny.height)).clone());
+    }
+    DiffStats dither;
+    DitherRows rows;
+    for (const cv::Mat& img : ditherInputs) {
+        for (int strength : {1, 8, 18, 64, 255}) {
+            ref = retro_v1::applyOrderedDither(img, strength);
+            for (int threads : {1, 0}) {
+                applyOrderedDitherInto(img, out, strength, rows, -1, threads);
+                dither.add(ref, out);
+            }
+        }
+    }
+
+    // 5) RGB555 dither + snap vs the scalar reference, exhaustively: an
+    // 8 x 2048 image where x = 8 * v + bx puts every input level v in every
+    // one of the 64 Bayer cells (B = v, G = 255 - v, R = v scrambled), run
+    // at every strength that gives a distinct set of offsets, plus the odd
+    // widths and tiny images above for the scalar tail
+    cv::Mat levels(8, 256 * 8, CV_8UC3);
+    for (int y = 0; y < levels.rows; ++y) {
+        uchar* p = levels.ptr<uchar>(y);
+        for (int x = 0; x < levels.cols; ++x, p += 3) {
+            const int v = x >> 3;
+            p[0] = uchar(v);
+            p[1] = uchar(255 - v);
+            p[2] = uchar(v * 167 + 13);
+        }
+    }
+    DiffStats rgb555;
+    for (int strength = 0; strength <= 255; ++strength) {
+        ditherRgb555Into(levels, out, strength, rows);
+        rgb555.add(rgb555Reference(levels, strength), out);
+    }
+    for (size_t i = inputs.size(); i < ditherInputs.size(); ++i) {
+        for (int strength : {0, 8, 18}) {
+            ditherRgb555Into(ditherInputs[i], out, strength, rows, -1, 1);
+            rgb555.add(rgb555Reference(ditherInputs[i], strength), out);
+        }
+    }
+
+    // 6) palette cube vs an exact nearest search, over every 24-bit colour,
+    // for fitted palettes of the 240p corpus and a few fixed ones. The
+    // excess is bounded by twice the largest pixel-to-cell-centre distance.
+    LutError lutError;
+    std::vector<cv::Mat> palettes;
+    for (size_t i = 1; i < inputs.size(); ++i) {
+        if (inputs[i].rows != 240) continue;
+        downscaleStage(inputs[i], small, internalWidth);
+        kmeansQuantize(small, 16, 3, &palette);
+        palettes.push_back(palette.clone());
+    }
+    for (const char* name : {"gb", "pico8", "nes"}) {
+        loadPalette(name, palette);
+        palettes.push_back(palette.clone());
+    }
+    PaletteLUT cube(6);
+    for (const cv::Mat& pal : palettes) {
+        lutError.add(colours, quantizeToPalette(colours, pal, cube), pal);
+    }
+    const double lutBound = 2.0 * std::sqrt(3.0) * double(1 << (7 - cube.bitsPerChannel()));
+
+    bool ok = reportDiff("contrast", contrast, 1);
+    ok = reportDiff("low-res", lowRes, 28) && ok;
+    ok = reportDiff("upscale", upscale, 0) && ok;
+    ok = reportDiff("up+sharpen", upSharpen, 0) && ok;
+    ok = reportDiff("indexed", indexed, 0) && ok;
+    ok = reportDiff("dither", dither, 0) && ok;
+    ok = reportDiff("rgb555", rgb555, 0) && ok;
+
+    const bool lutOk = lutError.maxExcess <= lutBound + 1e-9;
+    std::cout << std::left << std::setw(12) << "palette lut" << std::right << "max excess "
+              << std::setprecision(3) << lutError.maxExcess << " (bound " << lutBound << "), mean "
+              << lutError.sumExcess / std::max(1.0, lutError.total) << ", "
+              << 100.0 * lutError.differing / std::max(1.0, lutError.total)
+              << "% of colours farther than the nearest  " << (lutOk ? "ok" : "FAIL") << "\n";
+    ok = lutOk && ok;
+
+    // 7) heap allocations. parallelFor must not allocate at all. Whole
+    // frames are only reported: the filter's own buffers are reused, but
+    // cv::kmeans, Canny and the resize/blur kernels manage their own scratch.
+    ThreadPool& pool = workerPool();
+    std::vector<int> hits(size_t(pool.size()) + 1);
+    long long before = g_allocations.load();
+    for (int call = 0; call < 1000; ++call) {
+        pool.parallelFor((int)hits.size(), [&](int i) { hits[i]++; });
+    }
+    const long long poolAllocs = g_allocations.load() - before;
+    std::cout << std::left << std::setw(12) << "pool" << std::right << poolAllocs
+              << " allocations in 1000 parallelFor calls  " << (poolAllocs == 0 ? "ok" : "FAIL") << "\n";
+    ok = poolAllocs == 0 && ok;
+
+    struct AllocMode {
+        const char* name;
+        QuantizeMode quantizer;
+        bool dmg;
+    };
+    cv::Mat fixedPalette;
+    loadPalette("pico8", fixedPalette);
+    for (const AllocMode& mode : {AllocMode{"kmeans", QuantizeMode::KMeans, false},
+                                  AllocMode{"histogram", QuantizeMode::Histogram, false},
+                                  AllocMode{"subsample", QuantizeMode::Subsample, false},
+                                  AllocMode{"fixed", QuantizeMode::Fixed, false},
+                                  AllocMode{"rgb555", QuantizeMode::Rgb555, false},
+                                  AllocMode{"dmg", QuantizeMode::KMeans, true}}) {
+        RetroFilterOptions allocOpt;
+        allocOpt.targetWidth = internalWidth;
+        allocOpt.quantizer = mode.quantizer;
+        allocOpt.fixedPalette = fixedPalette;
+        allocOpt.dmg = mode.dmg;
+        allocOpt.edgeHintMode = EdgeHintMode::Fast;
+        RetroFilterContext allocCtx(allocOpt);
+        allocCtx.warmStart = true;
+        const cv::Mat& frame = inputs[1];
+        for (int warmup = 0; warmup < 3; ++warmup) gbaRetroFilter(frame, out, allocCtx);
+        before = g_allocations.load();
+        for (int f = 0; f < 10; ++f) gbaRetroFilter(frame, out, allocCtx);
+        std::cout << std::left << std::setw(12) << "allocs" << std::right << std::setw(10) << mode.name
+                  << ": " << double(g_allocations.load() - before) / 10.0
+                  << " operator new calls per frame (fast edge hint; reported only)\n";
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    bool validate = false;
+    double minSeconds = 0.25;
+    int internalWidth = 240;
+    std::string csvPath;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--min-time" && hasValue) {
+            minSeconds = std::max(0.0, std::atof(argv[++i]));
+        } else if (arg == "--width" && hasValue) {
+            internalWidth = std::max(8, std::atoi(argv[++i]));
+        } else if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--csv" && hasValue) {
+            csvPath = argv[++i];
+        } else {
+            std::cerr << "Error: unknown argument: " << arg << "\n";
+            return -1;
+        }
+    }
+
+    if (validate) return runValidation(quick, internalWidth);
+
+    std::cout << "retro_bench: " << workerPool().size() + 1 << " filter threads, "
+              << cv::getNumThreads() << " OpenCV threads\n";
+
+    BenchReport report(minSeconds);
+    for (CorpusKind kind : {CorpusKind::Gradient, CorpusKind::Noise, CorpusKind::Photo}) {
+        if (quick && kind == CorpusKind::Noise) continue;
+        for (const CorpusSize& cs : CORPUS_SIZES) {
+            if (quick && std::string(cs.name) != "240p" && std::string(cs.name) != "1080p") continue;
+            const cv::Mat img = makeCorpusImage(kind, cv::Size(cs.width, cs.height));
+            benchImage(report, corpusName(kind), cs, img, internalWidth);
+        }
+    }
+
+    if (!csvPath.empty() && !report.writeCsv(csvPath)) {
+        std::cerr << "Error: could not write CSV: " << csvPath << "\n";
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,1732 @@
+// retro_filter.cpp - GBA retro filter implementation (see retro_filter.hpp)
+#include "retro_filter.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <cctype>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+
+// ---------------------- Bayer + clamp ----------------------
+static const int BAYER8[8][8] = {
+    { 0, 48, 12, 60,  3, 51, 15, 63},
+    {32, 16, 44, 28, 35, 19, 47, 31},
+    { 8, 56,  4, 52, 11, 59,  7, 55},
+    {40, 24, 36, 20, 43, 27, 39, 23},
+    { 2, 50, 14, 62,  1, 49, 13, 61},
+    {34, 18, 46, 30, 33, 17, 45, 29},
+    {10, 58,  6, 54,  9, 57,  5, 53},
+    {42, 26, 38, 22, 41, 25, 37, 21}
+};
+
+static inline uchar clampU8(int v) {
+    return (uchar)std::max(0, std::min(255, v));
+}
+
+// ---------------------- Worker pool ----------------------
+// One pool for the whole process; the caller of parallelFor() is the
+// extra thread, so hardware_concurrency() bands keep every core busy.
+ThreadPool& workerPool() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+// ---------------------- Dither offset rows ----------------------
+void DitherRows::build(int s, int w) {
+    strength = s;
+    width = w;
+    plus.assign(size_t(8) * w * 3, 0);
+    minus.assign(size_t(8) * w * 3, 0);
+
+    for (int by = 0; by < 8; ++by) {
+        uchar* pr = plus.data() + size_t(by) * w * 3;
+        uchar* mr = minus.data() + size_t(by) * w * 3;
+        for (int x = 0; x < w; ++x) {
+            const int tval = BAYER8[by][x & 7]; // 0..63
+
+            const float norm = (float(tval) - 31.5f) / 63.0f;
+            const int offset = (int)std::lround(norm * float(strength));
+
+            const uchar up   = clampU8(offset);
+            const uchar down = clampU8(-offset);
+            for (int c = 0; c < 3; ++c) {
+                pr[x * 3 + c] = up;
+                mr[x * 3 + c] = down;
+            }
+        }
+    }
+}
+
+// dst[i] = clampU8(src[i] + offset[i]) for n bytes, vectorised with
+// OpenCV universal intrinsics (SSE2 baseline, AVX2 with RETRO_ENABLE_AVX2).
+static void ditherRow(const uchar* src, uchar* dst, const uchar* plus, const uchar* minus, int n) {
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step = cv::VTraits<cv::v_uint8>::vlanes();
+    for (; i <= n - step; i += step) {
+        cv::v_uint8 v = cv::vx_load(src + i);
+        v = cv::v_sub(cv::v_add(v, cv::vx_load(plus + i)), cv::vx_load(minus + i));
+        cv::v_store(dst + i, v);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = clampU8(int(src[i]) + int(plus[i]) - int(minus[i]));
+    }
+}
+
+// Nearest 5-bit level of v, expanded back to 8 bits
+static inline uchar rgb555Level(int v) {
+    const int q = std::min(255, v + 4) & 0xF8;
+    return (uchar)(q | (q >> 5));
+}
+
+// dst[i] = rgb555Level(clampU8(src[i] + offset[i])); same vector scheme as
+// ditherRow. There are no 8-bit vector shifts, so q >> 5 is done on 16-bit
+// lanes and the bits shifted in from the neighbouring byte are masked off.
+static void ditherRgb555Row(const uchar* src, uchar* dst, const uchar* plus, const uchar* minus, int n) {
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step = cv::VTraits<cv::v_uint8>::vlanes();
+    const cv::v_uint8 half = cv::vx_setall_u8(4);
+    const cv::v_uint8 high5 = cv::vx_setall_u8(0xF8);
+    const cv::v_uint8 low3 = cv::vx_setall_u8(0x07);
+    for (; i <= n - step; i += step) {
+        cv::v_uint8 v = cv::vx_load(src + i);
+        v = cv::v_sub(cv::v_add(v, cv::vx_load(plus + i)), cv::vx_load(minus + i));
+        v = cv::v_and(cv::v_add(v, half), high5);
+        const cv::v_uint16 wide = cv::v_reinterpret_as_u16(v);
+        const cv::v_uint8 top = cv::v_and(cv::v_reinterpret_as_u8(cv::v_shr<5>(wide)), low3);
+        cv::v_store(dst + i, cv::v_or(v, top));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = rgb555Level(clampU8(int(src[i]) + int(plus[i]) - int(minus[i])));
+    }
+}
+
+// ---------------------- Threaded dithering ----------------------
+struct DitherTask {
+    const cv::Mat* src;     // CV_8UC3
+    cv::Mat* dst;           // CV_8UC3, same size (may alias src)
+    const DitherRows* rows;
+    int y0, y1;             // [y0, y1)
+    bool rgb555;            // also snap to 5 bits per channel
+};
+
+void DitherWorker(const DitherTask& t) {
+    const int h = t.src->rows;
+    const int n = t.src->cols * 3;
+
+    const int startY = std::max(0, t.y0);
+    const int endY   = std::min(h, t.y1);
+
+    auto rowKernel = t.rgb555 ? ditherRgb555Row : ditherRow;
+    for (int y = startY; y < endY; ++y) {
+        rowKernel(t.src->ptr<uchar>(y), t.dst->ptr<uchar>(y),
+                  t.rows->plusRow(y), t.rows->minusRow(y), n);
+    }
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    cv::vx_cleanup();
+#endif
+}
+
+// Shared by the plain and RGB555 dithers; strength 0 gives all-zero rows
+static void ditherBands(const cv::Mat& bgr, cv::Mat& out, int strength, DitherRows& rows,
+                        int traceFrame, int maxThreads, bool rgb555) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    CV_Assert(strength >= 0);
+
+    // Written straight from bgr into out: no clone pass before the kernel.
+    out.create(bgr.size(), bgr.type());
+    if (!rows.matches(strength, bgr.cols)) rows.build(strength, bgr.cols);
+
+    ThreadPool& pool = workerPool();
+    const int threads = maxThreads > 0 ? std::min(maxThreads, pool.size() + 1) : pool.size() + 1;
+    const int bands = std::min(out.rows, threads);
+    if (bands <= 0) return;
+    const int rowsPerBand = (out.rows + bands - 1) / bands;
+
+    pool.parallelFor(bands, [&](int i) {
+        TraceSpan span("dither_band", traceFrame);
+        const DitherTask task = { &bgr, &out, &rows, i * rowsPerBand, (i + 1) * rowsPerBand, rgb555 };
+        DitherWorker(task);
+    });
+}
+
+void applyOrderedDitherInto(const cv::Mat& bgr, cv::Mat& out, int strength, DitherRows& rows,
+                            int traceFrame, int maxThreads) {
+    CV_Assert(strength > 0);
+    ditherBands(bgr, out, strength, rows, traceFrame, maxThreads, false);
+}
+
+void ditherRgb555Into(const cv::Mat& bgr, cv::Mat& out, int strength, DitherRows& rows,
+                      int traceFrame, int maxThreads) {
+    ditherBands(bgr, out, std::max(0, strength), rows, traceFrame, maxThreads, true);
+}
+
+cv::Mat applyOrderedDither(const cv::Mat& bgr, int strength) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    if (strength <= 0) return bgr.clone();
+
+    cv::Mat out;
+    DitherRows rows;
+    applyOrderedDitherInto(bgr, out, strength, rows);
+    return out;
+}
+
+// ---------------------- DMG 4-shade (single channel) ----------------------
+// Splits [0, rows) into one band per pool thread (capped by maxThreads)
+template <typename Fn>
+static void forEachBand(int rows, int maxThreads, const Fn& fn) {
+    ThreadPool& pool = workerPool();
+    const int threads = maxThreads > 0 ? std::min(maxThreads, pool.size() + 1) : pool.size() + 1;
+    const int bands = std::min(rows, threads);
+    if (bands <= 0) return;
+    const int rowsPerBand = (rows + bands - 1) / bands;
+    pool.parallelFor(bands, [&](int i) {
+        fn(i * rowsPerBand, std::min(rows, (i + 1) * rowsPerBand));
+    });
+}
+
+void DmgShadeLUT::build(int s) {
+    strength = s;
+    table.resize(64 * 256);
+    for (int cell = 0; cell < 64; ++cell) {
+        const float norm = (float(BAYER8[cell >> 3][cell & 7]) - 31.5f) / 63.0f;
+        const int offset = (int)std::lround(norm * float(strength));
+        uchar* t = table.data() + cell * 256;
+        for (int v = 0; v < 256; ++v) {
+            const int level = (int(clampU8(v + offset)) * 3 + 127) / 255; // 0..3
+            t[v] = (uchar)(level * 85);
+        }
+    }
+}
+
+void ditherDmgInto(const cv::Mat& luma, cv::Mat& out, int strength, DmgShadeLUT& lut,
+                   int traceFrame, int maxThreads) {
+    CV_Assert(luma.type() == CV_8UC1);
+    strength = std::max(0, strength);
+    if (lut.strength != strength) lut.build(strength);
+    out.create(luma.size(), CV_8UC1);
+
+    forEachBand(luma.rows, maxThreads, [&](int y0, int y1) {
+        TraceSpan span("dither_band", traceFrame);
+        for (int y = y0; y < y1; ++y) {
+            const uchar* s = luma.ptr<uchar>(y);
+            uchar* d = out.ptr<uchar>(y);
+            const uchar* rowTable = lut.table.data() + (y & 7) * 8 * 256;
+            for (int x = 0; x < luma.cols; ++x) d[x] = rowTable[(x & 7) * 256 + s[x]];
+        }
+    });
+}
+
+void colorizeDmgInto(const cv::Mat& luma, cv::Mat& out, const cv::Vec3b shades[4]) {
+    CV_Assert(luma.type() == CV_8UC1);
+    out.create(luma.size(), CV_8UC3);
+
+    cv::Vec3b ramp[256];
+    for (int v = 0; v < 256; ++v) {
+        const int i = std::min(2, v / 85);
+        const float f = float(v - 85 * i) / 85.0f;
+        for (int c = 0; c < 3; ++c) {
+            ramp[v][c] = clampU8((int)std::lround(shades[i][c] * (1.0f - f) + shades[i + 1][c] * f));
+        }
+    }
+
+    forEachBand(luma.rows, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uchar* s = luma.ptr<uchar>(y);
+            cv::Vec3b* d = out.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < luma.cols; ++x) d[x] = ramp[s[x]];
+        }
+    });
+}
+
+// ---------------------- Palette lookup cube ----------------------
+cv::Mat quantizeToPalette(const cv::Mat& bgr, const cv::Mat& palette, PaletteLUT& lut) {
+    lut.update(palette);
+    cv::Mat out;
+    lut.apply(bgr, out);
+    return out;
+}
+
+// ---------------------- Fixed palettes ----------------------
+// 0xRRGGBB
+static const uint32_t PAL_GB[] = { 0x0F380F, 0x306230, 0x8BAC0F, 0x9BBC0F };
+
+// Game Boy Color boot palette for monochrome games ("right" default)
+static const uint32_t PAL_GBC[] = { 0x000000, 0x0063C5, 0x7BFF31, 0xFFFFFF };
+
+// NES 2C02, the common emulator rendition; duplicate blacks are dropped
+static const uint32_t PAL_NES[] = {
+    0x7C7C7C, 0x0000FC, 0x0000BC, 0x4428BC, 0x940084, 0xA80020, 0xA81000, 0x881400,
+    0x503000, 0x007800, 0x006800, 0x005800, 0x004058, 0x000000,
+    0xBCBCBC, 0x0078F8, 0x0058F8, 0x6844FC, 0xD800CC, 0xE40058, 0xF83800, 0xE45C10,
+    0xAC7C00, 0x00B800, 0x00A800, 0x00A844, 0x008888,
+    0xF8F8F8, 0x3CBCFC, 0x6888FC, 0x9878F8, 0xF878F8, 0xF85898, 0xF87858, 0xFCA044,
+    0xF8B800, 0xB8F818, 0x58D854, 0x58F898, 0x00E8D8, 0x787878,
+    0xFCFCFC, 0xA4E4FC, 0xB8B8F8, 0xD8B8F8, 0xF8B8F8, 0xF8A4C0, 0xF0D0B0, 0xFCE0A8,
+    0xF8D878, 0xD8F878, 0xB8F8B8, 0xB8F8D8, 0x00FCFC, 0xF8D8F8
+};
+
+static const uint32_t PAL_PICO8[] = {
+    0x000000, 0x1D2B53, 0x7E2553, 0x008751, 0xAB5236, 0x5F574F, 0xC2C3C7, 0xFFF1E8,
+    0xFF004D, 0xFFA300, 0xFFEC27, 0x00E436, 0x29ADFF, 0x83769C, 0xFF77A8, 0xFFCCAA
+};
+
+// Full 16-colour CGA / EGA default
+static const uint32_t PAL_CGA[] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+// CGA 320x200 mode, palette 1 high intensity
+static const uint32_t PAL_CGA4[] = { 0x000000, 0x55FFFF, 0xFF55FF, 0xFFFFFF };
+
+struct NamedPalette {
+    const char* name;
+    const uint32_t* rgb;
+    int count;
+};
+
+#define RETRO_PALETTE(name, table) { name, table, int(sizeof(table) / sizeof(table[0])) }
+static const NamedPalette NAMED_PALETTES[] = {
+    RETRO_PALETTE("gb", PAL_GB),
+    RETRO_PALETTE("gbc", PAL_GBC),
+    RETRO_PALETTE("nes", PAL_NES),
+    RETRO_PALETTE("pico8", PAL_PICO8),
+    RETRO_PALETTE("cga", PAL_CGA),
+    RETRO_PALETTE("cga4", PAL_CGA4),
+};
+#undef RETRO_PALETTE
+
+std::vector<std::string> paletteNames() {
+    std::vector<std::string> names;
+    for (const NamedPalette& p : NAMED_PALETTES) names.push_back(p.name);
+    return names;
+}
+
+// 0xRRGGBB list -> Kx3 BGR, first occurrence of each colour kept
+static void paletteFromRgb(const std::vector<uint32_t>& rgb, cv::Mat& palette) {
+    std::vector<uint32_t> unique;
+    for (uint32_t c : rgb) {
+        c &= 0xFFFFFF;
+        if (std::find(unique.begin(), unique.end(), c) == unique.end()) unique.push_back(c);
+    }
+    palette.create((int)unique.size(), 3, CV_8UC1);
+    for (int k = 0; k < palette.rows; ++k) {
+        uchar* d = palette.ptr<uchar>(k);
+        d[0] = uchar(unique[k]);
+        d[1] = uchar(unique[k] >> 8);
+        d[2] = uchar(unique[k] >> 16);
+    }
+}
+
+static std::string lowerCase(std::string s) {
+    for (char& c : s) c = (char)std::tolower((unsigned char)c);
+    return s;
+}
+
+// GIMP palette: "GIMP Palette" header, optional Name:/Columns: lines,
+// '#' comments, then "R G B [name]" per line
+static bool readGpl(std::istream& f, std::vector<uint32_t>& rgb) {
+    std::string line;
+    if (!std::getline(f, line) || line.compare(0, 12, "GIMP Palette") != 0) return false;
+    while (std::getline(f, line)) {
+        int r, g, b;
+        if (std::sscanf(line.c_str(), " %d %d %d", &r, &g, &b) != 3) continue;
+        rgb.push_back(uint32_t(clampU8(r)) << 16 | uint32_t(clampU8(g)) << 8 | clampU8(b));
+    }
+    return true;
+}
+
+// Adobe colour table: 256 RGB triples, optionally followed by a big-endian
+// u16 colour count and a u16 transparent index
+static bool readAct(std::istream& f, std::vector<uint32_t>& rgb) {
+    uchar data[772] = {};
+    f.read((char*)data, sizeof(data));
+    const std::streamsize n = f.gcount();
+    if (n < 768) return false;
+    int count = 256;
+    if (n == 772) {
+        const int stored = (data[768] << 8) | data[769];
+        if (stored > 0 && stored <= 256) count = stored;
+    }
+    for (int i = 0; i < count; ++i) {
+        rgb.push_back(uint32_t(data[3 * i]) << 16 | uint32_t(data[3 * i + 1]) << 8 | data[3 * i + 2]);
+    }
+    return true;
+}
+
+// One RRGGBB per line, '#' prefix optional (lospec.com format)
+static bool readHex(std::istream& f, std::vector<uint32_t>& rgb) {
+    std::string line;
+    while (std::getline(f, line)) {
+        size_t i = line.find_first_not_of(" \t#");
+        if (i == std::string::npos) continue;
+        unsigned v = 0;
+        if (std::sscanf(line.c_str() + i, "%6x", &v) != 1) return false;
+        rgb.push_back(v);
+    }
+    return true;
+}
+
+bool loadPalette(const std::string& spec, cv::Mat& palette, std::string* error) {
+    palette.release();
+    auto fail = [&](const std::string& msg) {
+        if (error) *error = msg;
+        return false;
+    };
+
+    std::vector<uint32_t> rgb;
+    const std::string key = lowerCase(spec);
+    for (const NamedPalette& p : NAMED_PALETTES) {
+        if (key == p.name) rgb.assign(p.rgb, p.rgb + p.count);
+    }
+
+    if (rgb.empty()) {
+        const size_t dot = key.find_last_of('.');
+        const std::string ext = dot == std::string::npos ? "" : key.substr(dot);
+        if (ext != ".gpl" && ext != ".act" && ext != ".hex") {
+            return fail("unknown palette (expected a preset name or a .gpl/.act/.hex file): " + spec);
+        }
+        std::ifstream f(spec, std::ios::binary);
+        if (!f) return fail("could not open palette file: " + spec);
+        const bool ok = ext == ".gpl" ? readGpl(f, rgb) : ext == ".act" ? readAct(f, rgb) : readHex(f, rgb);
+        if (!ok) return fail("could not parse palette file: " + spec);
+    }
+
+    paletteFromRgb(rgb, palette);
+    if (palette.rows < 1 || palette.rows > 256) {
+        palette.release();
+        return fail("palette must have 1 to 256 distinct colours: " + spec);
+    }
+    return true;
+}
+
+// ---------------------- Warm-started k-means (video) ----------------------
+// labels[i] = index of the center nearest to samples.row(i)
+static void assignNearest(const cv::Mat& samples, const cv::Mat& centers, cv::Mat& labels) {
+    const int N = samples.rows;
+    const int K = centers.rows;
+    labels.create(N, 1, CV_32S);
+
+    const float* c = centers.ptr<float>(0);
+    int* lab = labels.ptr<int>(0);
+    for (int i = 0; i < N; ++i) {
+        const float* s = samples.ptr<float>(i);
+        int best = 0;
+        float bestD = FLT_MAX;
+        for (int k = 0; k < K; ++k) {
+            const float db = s[0] - c[3 * k + 0];
+            const float dg = s[1] - c[3 * k + 1];
+            const float dr = s[2] - c[3 * k + 2];
+            const float d = db * db + dg * dg + dr * dr;
+            if (d < bestD) { bestD = d; best = k; }
+        }
+        lab[i] = best;
+    }
+}
+
+// ---------------------- K-means quantization ----------------------
+// cv::kmeans on Nx3 CV_32F samples, warm-started from `warm` when it holds
+// a compatible palette. Returns the compactness of the accepted fit.
+static double fitKMeans(const cv::Mat& samples, int K, int attempts, KMeansWarmStart* warm,
+                        cv::Mat& labels, cv::Mat& centers) {
+    cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 1.0);
+    const double N = double(samples.rows);
+
+    if (warm && warm->centers.rows == K && warm->refCompactness > 0.0) {
+        assignNearest(samples, warm->centers, labels);
+        const double c = cv::kmeans(samples, K, labels, criteria, 1, cv::KMEANS_USE_INITIAL_LABELS, centers);
+        if (c / N <= warm->refCompactness * warm->degradeRatio) {
+            warm->warmFits++;
+            centers.copyTo(warm->centers);
+            return c;
+        }
+    }
+
+    const double c = cv::kmeans(samples, K, labels, criteria, attempts, cv::KMEANS_PP_CENTERS, centers);
+    if (warm) {
+        warm->refCompactness = std::max(c / N, 1e-6);
+        warm->fullFits++;
+        centers.copyTo(warm->centers);
+    }
+    return c;
+}
+
+// indices = palette index (CV_8U) of every pixel of bgr; the K colours
+// are left in ws.palette8.
+// warm (optional) carries centers between video frames, see KMeansWarmStart.
+static void kmeansQuantizeInto(const cv::Mat& bgr, cv::Mat& indices, int K, int attempts,
+                               QuantizeScratch& ws, KMeansWarmStart* warm) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    CV_Assert(K >= 2 && K <= 256);
+
+    bgr.convertTo(ws.samples, CV_32F);
+    const cv::Mat samples = ws.samples.reshape(1, bgr.rows * bgr.cols); // Nx3
+
+    fitKMeans(samples, K, attempts, warm, ws.labels, ws.centers);
+    ws.centers.convertTo(ws.palette8, CV_8U);
+
+    indices.create(bgr.size(), CV_8UC1);
+    const int* lab = ws.labels.ptr<int>(0);
+    for (int y = 0; y < bgr.rows; ++y) {
+        uchar* d = indices.ptr<uchar>(y);
+        for (int x = 0; x < bgr.cols; ++x) d[x] = (uchar)(*lab++);
+    }
+}
+
+cv::Mat kmeansQuantize(const cv::Mat& bgr, int K, int attempts,
+                       cv::Mat* paletteOut, KMeansWarmStart* warm) {
+    QuantizeScratch ws;
+    cv::Mat indices, out;
+    kmeansQuantizeInto(bgr, indices, K, attempts, ws, warm);
+    expandPalette(indices, ws.palette8, out);
+    if (paletteOut) *paletteOut = ws.palette8;
+    return out;
+}
+
+// ---------------------- Subsampled k-means ----------------------
+// indices = nearest(centers) for every pixel; returns the compactness
+// (sum of squared distances to the float centers) over all pixels.
+static double assignPixels(const cv::Mat& bgr, const cv::Mat& centers, cv::Mat& indices,
+                           std::vector<float>& rowBuf) {
+    const int K = centers.rows;
+    const int w = bgr.cols;
+    const float* c = centers.ptr<float>(0);
+    indices.create(bgr.size(), CV_8UC1);
+
+    ThreadPool& pool = workerPool();
+    const int bands = std::min({bgr.rows, pool.size() + 1, 256});
+    if (bands <= 0) return 0.0;
+    const int rowsPerBand = (bgr.rows + bands - 1) / bands;
+    double bandSum[256] = {};
+    rowBuf.resize(size_t(bands) * 5 * w);
+
+    pool.parallelFor(bands, [&](int band) {
+        // planar float copies of one row + per-pixel best distance / label
+        float* pb   = rowBuf.data() + size_t(band) * 5 * w;
+        float* pg   = pb + w;
+        float* pr   = pg + w;
+        float* best = pr + w;
+        float* lab  = best + w;
+        double sum = 0.0;
+
+        const int y1 = std::min(bgr.rows, (band + 1) * rowsPerBand);
+        for (int y = band * rowsPerBand; y < y1; ++y) {
+            const uchar* s = bgr.ptr<uchar>(y);
+            for (int x = 0; x < w; ++x) {
+                pb[x] = s[3 * x + 0];
+                pg[x] = s[3 * x + 1];
+                pr[x] = s[3 * x + 2];
+            }
+
+            int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+            const int vl = cv::VTraits<cv::v_float32>::vlanes();
+            for (; x <= w - vl; x += vl) {
+                const cv::v_float32 vb = cv::vx_load(&pb[x]);
+                const cv::v_float32 vg = cv::vx_load(&pg[x]);
+                const cv::v_float32 vr = cv::vx_load(&pr[x]);
+                cv::v_float32 vbest = cv::vx_setall_f32(FLT_MAX);
+                cv::v_float32 vlab = cv::vx_setzero_f32();
+                for (int k = 0; k < K; ++k) {
+                    const cv::v_float32 db = cv::v_sub(vb, cv::vx_setall_f32(c[3 * k + 0]));
+                    const cv::v_float32 dg = cv::v_sub(vg, cv::vx_setall_f32(c[3 * k + 1]));
+                    const cv::v_float32 dr = cv::v_sub(vr, cv::vx_setall_f32(c[3 * k + 2]));
+                    const cv::v_float32 d = cv::v_muladd(dr, dr, cv::v_muladd(dg, dg, cv::v_mul(db, db)));
+                    const cv::v_float32 closer = cv::v_lt(d, vbest);
+                    vbest = cv::v_select(closer, d, vbest);
+                    vlab = cv::v_select(closer, cv::vx_setall_f32(float(k)), vlab);
+                }
+                cv::v_store(&best[x], vbest);
+                cv::v_store(&lab[x], vlab);
+            }
+#endif
+            for (; x < w; ++x) {
+                float bestD = FLT_MAX;
+                int bestK = 0;
+                for (int k = 0; k < K; ++k) {
+                    const float db = pb[x] - c[3 * k + 0];
+                    const float dg = pg[x] - c[3 * k + 1];
+                    const float dr = pr[x] - c[3 * k + 2];
+                    const float d = db * db + dg * dg + dr * dr;
+                    if (d < bestD) { bestD = d; bestK = k; }
+                }
+                best[x] = bestD;
+                lab[x] = float(bestK);
+            }
+
+            uchar* d = indices.ptr<uchar>(y);
+            for (x = 0; x < w; ++x) {
+                d[x] = (uchar)int(lab[x]);
+                sum += best[x];
+            }
+        }
+        bandSum[band] = sum;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        cv::vx_cleanup();
+#endif
+    });
+
+    double total = 0.0;
+    for (int i = 0; i < bands; ++i) total += bandSum[i];
+    return total;
+}
+
+// validate: also run cv::kmeans on every pixel and report its compactness
+// in stats->referenceCompactness (expensive; for checking the mode only).
+static void subsampleQuantizeInto(const cv::Mat& bgr, cv::Mat& indices, int K, int sampleCount, int attempts,
+                                  QuantizeScratch& ws, KMeansWarmStart* warm,
+                                  QuantizeStats* stats, bool validate) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    CV_Assert(K >= 2 && K <= 256);
+
+    const int N = bgr.rows * bgr.cols;
+    const int S = std::max(K, std::min(sampleCount, N));
+
+    // One pixel per stride, jittered with a fixed seed: spread over the whole
+    // frame and identical from run to run.
+    ws.samples.create(S, 3, CV_32F);
+    cv::Mat& samples = ws.samples;
+    cv::RNG rng(0x9E3779B9u);
+    const double stride = double(N) / S;
+    for (int i = 0; i < S; ++i) {
+        const int lo = int(i * stride);
+        const int hi = std::max(lo + 1, int((i + 1) * stride));
+        const int idx = std::min(N - 1, rng.uniform(lo, hi));
+        const uchar* p = bgr.ptr<uchar>(idx / bgr.cols) + 3 * (idx % bgr.cols);
+        float* d = samples.ptr<float>(i);
+        d[0] = p[0];
+        d[1] = p[1];
+        d[2] = p[2];
+    }
+
+    fitKMeans(samples, K, attempts, warm, ws.labels, ws.centers);
+    ws.centers.convertTo(ws.palette8, CV_8U);
+
+    const double compactness = assignPixels(bgr, ws.centers, indices, ws.rowBuf);
+
+    if (stats) {
+        stats->compactness = compactness;
+        stats->referenceCompactness = 0.0;
+        if (validate) {
+            cv::Mat all, fullLabels, fullCenters;
+            bgr.convertTo(all, CV_32F);
+            all = all.reshape(1, N);
+            cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 1.0);
+            stats->referenceCompactness =
+                cv::kmeans(all, K, fullLabels, criteria, attempts, cv::KMEANS_PP_CENTERS, fullCenters);
+        }
+    }
+}
+
+cv::Mat subsampleQuantize(const cv::Mat& bgr, int K, int sampleCount, int attempts,
+                          cv::Mat* paletteOut, KMeansWarmStart* warm,
+                          QuantizeStats* stats, bool validate) {
+    QuantizeScratch ws;
+    cv::Mat indices, out;
+    subsampleQuantizeInto(bgr, indices, K, sampleCount, attempts, ws, warm, stats, validate);
+    expandPalette(indices, ws.palette8, out);
+    if (paletteOut) *paletteOut = ws.palette8;
+    return out;
+}
+
+// ---------------------- Histogram k-means ----------------------
+// Clusters a weighted colour histogram instead of every pixel. Pixels are
+// binned by the top `bits` bits of each channel; every occupied bin becomes
+// one point at the mean colour of its pixels, weighted by its pixel count,
+// and weighted Lloyd iterations run over those points only (typically a
+// few thousand). Cost is one pass to fill the histogram plus work that
+// depends on the number of distinct colours, not on targetWidth. Pixels
+// take the palette entry of their bin, so two pixels in the same bin always
+// map to the same colour.
+// Weighted Lloyd iterations from the given centers; returns sum(w * d^2)
+// and leaves the nearest center of each point in `labels`.
+static double weightedLloyd(const WeightedPoints& wp, cv::Mat& centers, std::vector<int>& labels,
+                            const cv::TermCriteria& criteria, QuantizeScratch& ws) {
+    const int M = wp.size();
+    const int K = centers.rows;
+    labels.assign(M, 0);
+
+    std::vector<double>& sum = ws.sum;
+    std::vector<double>& wsum = ws.wsum;
+    std::vector<float>& dist = ws.dist;
+    sum.resize(size_t(K) * 3);
+    wsum.resize(K);
+    dist.resize(M);
+    double compactness = 0.0;
+    bool converged = false;
+
+    for (int iter = 0; ; ++iter) {
+        // Assignment
+        compactness = 0.0;
+        const float* c = centers.ptr<float>(0);
+        for (int i = 0; i < M; ++i) {
+            const float* p = &wp.pts[3 * i];
+            int best = 0;
+            float bestD = FLT_MAX;
+            for (int k = 0; k < K; ++k) {
+                const float db = p[0] - c[3 * k + 0];
+                const float dg = p[1] - c[3 * k + 1];
+                const float dr = p[2] - c[3 * k + 2];
+                const float d = db * db + dg * dg + dr * dr;
+                if (d < bestD) { bestD = d; best = k; }
+            }
+            labels[i] = best;
+            dist[i] = bestD;
+            compactness += double(wp.wts[i]) * bestD;
+        }
+
+        if (converged || iter >= criteria.maxCount) break;
+
+        // Update
+        std::fill(sum.begin(), sum.end(), 0.0);
+        std::fill(wsum.begin(), wsum.end(), 0.0);
+        for (int i = 0; i < M; ++i) {
+            const int k = labels[i];
+            const double w = wp.wts[i];
+            sum[3 * k + 0] += w * wp.pts[3 * i + 0];
+            sum[3 * k + 1] += w * wp.pts[3 * i + 1];
+            sum[3 * k + 2] += w * wp.pts[3 * i + 2];
+            wsum[k] += w;
+        }
+
+        double maxShift = 0.0;
+        for (int k = 0; k < K; ++k) {
+            float* ck = centers.ptr<float>(k);
+            float nb, ng, nr;
+            if (wsum[k] > 0.0) {
+                nb = float(sum[3 * k + 0] / wsum[k]);
+                ng = float(sum[3 * k + 1] / wsum[k]);
+                nr = float(sum[3 * k + 2] / wsum[k]);
+            } else {
+                // Empty cluster: move it to the worst-fitted point
+                int far = 0;
+                for (int i = 1; i < M; ++i) {
+                    if (wp.wts[i] * dist[i] > wp.wts[far] * dist[far]) far = i;
+                }
+                nb = wp.pts[3 * far + 0];
+                ng = wp.pts[3 * far + 1];
+                nr = wp.pts[3 * far + 2];
+                dist[far] = 0.0f;
+            }
+            const double shift = double(nb - ck[0]) * (nb - ck[0]) +
+                                 double(ng - ck[1]) * (ng - ck[1]) +
+                                 double(nr - ck[2]) * (nr - ck[2]);
+            maxShift = std::max(maxShift, shift);
+            ck[0] = nb;
+            ck[1] = ng;
+            ck[2] = nr;
+        }
+
+        // Converged: one more assignment pass so labels match the centers
+        converged = maxShift <= criteria.epsilon * criteria.epsilon;
+    }
+    return compactness;
+}
+
+// Weighted k-means++ seeding (deterministic for a given rng state)
+static void weightedKMeansPP(const WeightedPoints& wp, int K, cv::RNG& rng, cv::Mat& centers,
+                             QuantizeScratch& ws) {
+    const int M = wp.size();
+    centers.create(K, 3, CV_32F);
+
+    std::vector<double>& d2 = ws.d2;
+    d2.assign(M, DBL_MAX);
+    auto pick = [&](const std::vector<double>& score) {
+        double total = 0.0;
+        for (int i = 0; i < M; ++i) total += score[i];
+        double r = rng.uniform(0.0, 1.0) * total;
+        for (int i = 0; i < M; ++i) {
+            r -= score[i];
+            if (r <= 0.0) return i;
+        }
+        return M - 1;
+    };
+
+    std::vector<double>& score = ws.score;
+    score.assign(wp.wts.begin(), wp.wts.end());
+    for (int k = 0; k < K; ++k) {
+        const int idx = pick(score);
+        float* ck = centers.ptr<float>(k);
+        ck[0] = wp.pts[3 * idx + 0];
+        ck[1] = wp.pts[3 * idx + 1];
+        ck[2] = wp.pts[3 * idx + 2];
+
+        for (int i = 0; i < M; ++i) {
+            const double db = wp.pts[3 * i + 0] - ck[0];
+            const double dg = wp.pts[3 * i + 1] - ck[1];
+            const double dr = wp.pts[3 * i + 2] - ck[2];
+            d2[i] = std::min(d2[i], db * db + dg * dg + dr * dr);
+            score[i] = wp.wts[i] * d2[i];
+        }
+    }
+}
+
+static void histogramQuantizeInto(const cv::Mat& bgr, cv::Mat& indices, int K, int bits, int attempts,
+                                  QuantizeScratch& ws, KMeansWarmStart* warm) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    CV_Assert(!bgr.empty());
+    CV_Assert(K >= 2 && K <= 256);
+    CV_Assert(bits >= 4 && bits <= 6);
+
+    const int shift = 8 - bits;
+    const int nbins = 1 << (3 * bits);
+    auto binOf = [&](const uchar* p) {
+        return ((p[0] >> shift) << (2 * bits)) | ((p[1] >> shift) << bits) | (p[2] >> shift);
+    };
+
+    // 1) Histogram with per-bin colour sums
+    std::vector<uint32_t>& count = ws.count;
+    std::vector<uint32_t>& sums = ws.sums;
+    count.assign(nbins, 0);
+    sums.assign(size_t(nbins) * 3, 0);
+    for (int y = 0; y < bgr.rows; ++y) {
+        const uchar* p = bgr.ptr<uchar>(y);
+        for (int x = 0; x < bgr.cols; ++x, p += 3) {
+            const int b = binOf(p);
+            count[b]++;
+            sums[3 * b + 0] += p[0];
+            sums[3 * b + 1] += p[1];
+            sums[3 * b + 2] += p[2];
+        }
+    }
+
+    // 2) Occupied bins -> weighted points
+    WeightedPoints& wp = ws.wp;
+    wp.pts.clear();
+    wp.wts.clear();
+    std::vector<int>& binPoint = ws.binPoint;
+    binPoint.assign(nbins, -1);
+    for (int b = 0; b < nbins; ++b) {
+        if (!count[b]) continue;
+        binPoint[b] = wp.size();
+        const float inv = 1.0f / float(count[b]);
+        wp.pts.push_back(float(sums[3 * b + 0]) * inv);
+        wp.pts.push_back(float(sums[3 * b + 1]) * inv);
+        wp.pts.push_back(float(sums[3 * b + 2]) * inv);
+        wp.wts.push_back(float(count[b]));
+    }
+    const int M = wp.size();
+    const double N = double(bgr.rows) * bgr.cols;
+
+    // 3) Weighted Lloyd over the occupied bins
+    cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 1.0);
+    cv::Mat& centers = ws.centers;
+    std::vector<int>& labels = ws.pointLabels;
+    bool fitted = false;
+
+    if (M <= K) {
+        // Fewer colours than palette entries: every bin is its own center
+        centers.create(K, 3, CV_32F);
+        for (int i = 0; i < K; ++i) {
+            const int src = std::min(i, M - 1);
+            std::copy(&wp.pts[3 * src], &wp.pts[3 * src] + 3, centers.ptr<float>(i));
+        }
+        labels.resize(M);
+        for (int i = 0; i < M; ++i) labels[i] = i;
+        fitted = true;
+    }
+
+    if (!fitted && warm && warm->centers.rows == K && warm->refCompactness > 0.0) {
+        warm->centers.copyTo(centers);
+        const double c = weightedLloyd(wp, centers, labels, criteria, ws);
+        if (c / N <= warm->refCompactness * warm->degradeRatio) {
+            warm->warmFits++;
+            fitted = true;
+        }
+    }
+
+    if (!fitted) {
+        cv::RNG rng(0x5EED1234u);
+        double best = DBL_MAX;
+        for (int a = 0; a < std::max(1, attempts); ++a) {
+            weightedKMeansPP(wp, K, rng, ws.trial, ws);
+            const double c = weightedLloyd(wp, ws.trial, ws.trialLabels, criteria, ws);
+            if (c < best) {
+                best = c;
+                ws.trial.copyTo(centers);
+                labels.swap(ws.trialLabels);
+            }
+        }
+        if (warm) {
+            warm->refCompactness = std::max(best / N, 1e-6);
+            warm->fullFits++;
+        }
+    }
+
+    if (warm) centers.copyTo(warm->centers);
+
+    centers.convertTo(ws.palette8, CV_8U);
+
+    // 4) Pixels take the palette entry of their bin
+    indices.create(bgr.size(), CV_8UC1);
+    for (int y = 0; y < bgr.rows; ++y) {
+        const uchar* p = bgr.ptr<uchar>(y);
+        uchar* d = indices.ptr<uchar>(y);
+        for (int x = 0; x < bgr.cols; ++x, p += 3) d[x] = (uchar)labels[binPoint[binOf(p)]];
+    }
+}
+
+cv::Mat histogramQuantize(const cv::Mat& bgr, int K, int bits, int attempts,
+                          cv::Mat* paletteOut, KMeansWarmStart* warm) {
+    QuantizeScratch ws;
+    cv::Mat indices, out;
+    histogramQuantizeInto(bgr, indices, K, bits, attempts, ws, warm);
+    expandPalette(indices, ws.palette8, out);
+    if (paletteOut) *paletteOut = ws.palette8;
+    return out;
+}
+
+// ---------------------- Fused contrast ----------------------
+// The contrast stage used to convert to YCrCb, scale Y by 1.10 and add 4,
+// then convert back. Cr and Cb do not change, so the round trip adds the
+// same luma change to B, G and R; only the rounding of the chroma planes
+// differs. The kernel computes Y with cvtColor's fixed-point coefficients,
+// reads Y' - Y from a table, and adds it to each channel, saturating: one
+// pass, no intermediate planes, within 1 LSB of the round trip for every
+// one of the 2^24 colours.
+static const int LUMA_SHIFT = 14;
+static const int LUMA_B = 1868, LUMA_G = 9617, LUMA_R = 4899;  // 0.114, 0.587, 0.299 << 14
+
+// Y -> Y' - Y, produced by convertTo itself so the rounding is identical
+static const short* contrastDeltaTable() {
+    static const std::vector<short> table = [] {
+        cv::Mat ramp(1, 256, CV_8U), scaled;
+        for (int i = 0; i < 256; ++i) ramp.at<uchar>(0, i) = (uchar)i;
+        ramp.convertTo(scaled, -1, 1.10, 4.0);
+        std::vector<short> t(256);
+        for (int i = 0; i < 256; ++i) t[i] = short(scaled.at<uchar>(0, i) - i);
+        return t;
+    }();
+    return table.data();
+}
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+// Y of 2 x (int16 lanes) pixels: (b, g) and (r, 1) pairs go through
+// v_dotprod, so 32-bit products and the rounding term cost two ops
+static inline cv::v_int16 lumaOf(const cv::v_uint16& b, const cv::v_uint16& g, const cv::v_uint16& r) {
+    const cv::v_int16 coefBG = cv::v_reinterpret_as_s16(cv::vx_setall_s32((LUMA_G << 16) | LUMA_B));
+    const cv::v_int16 coefR1 = cv::v_reinterpret_as_s16(cv::vx_setall_s32(((1 << (LUMA_SHIFT - 1)) << 16) | LUMA_R));
+    cv::v_int16 bg0, bg1, r0, r1;
+    cv::v_zip(cv::v_reinterpret_as_s16(b), cv::v_reinterpret_as_s16(g), bg0, bg1);
+    cv::v_zip(cv::v_reinterpret_as_s16(r), cv::vx_setall_s16(1), r0, r1);
+    const cv::v_int32 y0 = cv::v_shr<LUMA_SHIFT>(cv::v_add(cv::v_dotprod(bg0, coefBG), cv::v_dotprod(r0, coefR1)));
+    const cv::v_int32 y1 = cv::v_shr<LUMA_SHIFT>(cv::v_add(cv::v_dotprod(bg1, coefBG), cv::v_dotprod(r1, coefR1)));
+    return cv::v_pack(y0, y1);
+}
+
+// saturate(c + delta) for the two halves of a u8 vector
+static inline cv::v_uint8 addDelta(const cv::v_uint16& c0, const cv::v_uint16& c1,
+                                   const cv::v_int16& d0, const cv::v_int16& d1) {
+    return cv::v_pack_u(cv::v_add(cv::v_reinterpret_as_s16(c0), d0), cv::v_add(cv::v_reinterpret_as_s16(c1), d1));
+}
+#endif
+
+static void contrastRow(const uchar* src, uchar* dst, int w, const short* delta) {
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int vl = cv::VTraits<cv::v_uint8>::vlanes();
+    const int hl = cv::VTraits<cv::v_int16>::vlanes();
+    short ybuf[cv::VTraits<cv::v_uint8>::max_nlanes], dbuf[cv::VTraits<cv::v_uint8>::max_nlanes];
+    for (; x <= w - vl; x += vl) {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(src + 3 * x, b, g, r);
+        cv::v_uint16 b0, b1, g0, g1, r0, r1;
+        cv::v_expand(b, b0, b1);
+        cv::v_expand(g, g0, g1);
+        cv::v_expand(r, r0, r1);
+
+        // The delta is a 256-entry gather: done per lane from a stack buffer
+        cv::v_store(ybuf, lumaOf(b0, g0, r0));
+        cv::v_store(ybuf + hl, lumaOf(b1, g1, r1));
+        for (int i = 0; i < vl; ++i) dbuf[i] = delta[ybuf[i]];
+        const cv::v_int16 d0 = cv::vx_load(dbuf), d1 = cv::vx_load(dbuf + hl);
+
+        cv::v_store_interleave(dst + 3 * x, addDelta(b0, b1, d0, d1), addDelta(g0, g1, d0, d1),
+                               addDelta(r0, r1, d0, d1));
+    }
+#endif
+    for (; x < w; ++x) {
+        const uchar* s = src + 3 * x;
+        const int y = (s[0] * LUMA_B + s[1] * LUMA_G + s[2] * LUMA_R + (1 << (LUMA_SHIFT - 1))) >> LUMA_SHIFT;
+        const int d = delta[y];
+        uchar* o = dst + 3 * x;
+        o[0] = clampU8(s[0] + d);
+        o[1] = clampU8(s[1] + d);
+        o[2] = clampU8(s[2] + d);
+    }
+}
+
+// ---------------------- GBA filter ----------------------
+// 1) Mild contrast: luma * 1.10 + 4, fused (see above), threaded by row band
+void contrastStage(const cv::Mat& inputBgr, cv::Mat& out) {
+    CV_Assert(inputBgr.type() == CV_8UC3);
+    out.create(inputBgr.size(), CV_8UC3);
+    const short* delta = contrastDeltaTable();
+
+    forEachBand(inputBgr.rows, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            contrastRow(inputBgr.ptr<uchar>(y), out.ptr<uchar>(y), inputBgr.cols, delta);
+        }
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        cv::vx_cleanup();
+#endif
+    });
+}
+
+// 2) Downscale to targetWidth, keeping the aspect ratio
+void downscaleStage(const cv::Mat& bgr, cv::Mat& small, int targetWidth) {
+    const float scale = float(targetWidth) / float(bgr.cols);
+    const int targetHeight = std::max(1, int(std::lround(bgr.rows * scale)));
+    cv::resize(bgr, small, cv::Size(targetWidth, targetHeight), 0, 0, cv::INTER_AREA);
+}
+
+// 3) Edge hint: darken dilated Canny edges in place
+void edgeHintStage(cv::Mat& small, RetroFilterContext& ws) {
+    cv::cvtColor(small, ws.gray, cv::COLOR_BGR2GRAY);
+    cv::Canny(ws.gray, ws.edges, 60, 140);
+    cv::dilate(ws.edges, ws.edgesDilated, cv::Mat(), cv::Point(-1, -1), 1);
+
+    cv::cvtColor(ws.edgesDilated, ws.edgesBgr, cv::COLOR_GRAY2BGR);
+    ws.edgesBgr.convertTo(ws.halfEdges, CV_8U, 0.5);
+    cv::subtract(small, ws.halfEdges, small);
+}
+
+// 3) Edge hint, fast mode: Sobel |gx| + |gy| of the luma against Canny's
+// high threshold, then the same darkening, in one pass per row. There is
+// no non-maximum suppression, hysteresis or dilate: a step comes out as
+// about the 2-3 pixel band the dilated Canny line gives, but weak edges
+// that hysteresis would have followed are dropped.
+static const int EDGE_FAST_THRESHOLD = 140;  // cv::Canny high threshold (L1 gradient)
+static const int EDGE_DARKEN = 128;          // what convertTo(0.5) makes of 255
+
+// Border index for the 3x3 kernels: OpenCV's BORDER_REFLECT_101
+static inline int reflect101(int i, int n) {
+    if (n == 1) return 0;
+    if (i < 0) return -i;
+    if (i >= n) return 2 * n - 2 - i;
+    return i;
+}
+
+// Darkens the pixels of dst (1 or 3 channels) where the Sobel gradient of
+// the luma rows (up, mid, down) reaches the threshold
+static void fastEdgeRow(const uchar* u, const uchar* m, const uchar* d, uchar* dst, int w, int cn) {
+    auto scalarPixel = [&](int x) {
+        const int l = reflect101(x - 1, w), r = reflect101(x + 1, w);
+        const int gx = (u[r] - u[l]) + 2 * (m[r] - m[l]) + (d[r] - d[l]);
+        const int gy = (d[l] + 2 * d[x] + d[r]) - (u[l] + 2 * u[x] + u[r]);
+        if (std::abs(gx) + std::abs(gy) < EDGE_FAST_THRESHOLD) return;
+        for (int k = 0; k < cn; ++k) dst[x * cn + k] = (uchar)std::max(0, dst[x * cn + k] - EDGE_DARKEN);
+    };
+
+    if (w <= 0) return;
+    scalarPixel(0);
+    int x = 1;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int vl = cv::VTraits<cv::v_uint8>::vlanes();
+    const cv::v_uint16 threshold = cv::vx_setall_u16((ushort)EDGE_FAST_THRESHOLD);
+    const cv::v_uint8 darken = cv::vx_setall_u8((uchar)EDGE_DARKEN);
+    // |gx| + |gy| <= 8 * 255 fits int16; one half of the vector per call
+    auto magnitude = [&](const cv::v_uint16& ul, const cv::v_uint16& uc, const cv::v_uint16& ur,
+                         const cv::v_uint16& ml, const cv::v_uint16& mr,
+                         const cv::v_uint16& dl, const cv::v_uint16& dc, const cv::v_uint16& dr) {
+        const cv::v_int16 gx = cv::v_sub(cv::v_reinterpret_as_s16(cv::v_add(cv::v_add(ur, dr), cv::v_add(mr, mr))),
+                                         cv::v_reinterpret_as_s16(cv::v_add(cv::v_add(ul, dl), cv::v_add(ml, ml))));
+        const cv::v_int16 gy = cv::v_sub(cv::v_reinterpret_as_s16(cv::v_add(cv::v_add(dl, dr), cv::v_add(dc, dc))),
+                                         cv::v_reinterpret_as_s16(cv::v_add(cv::v_add(ul, ur), cv::v_add(uc, uc))));
+        return cv::v_ge(cv::v_add(cv::v_abs(gx), cv::v_abs(gy)), threshold);
+    };
+    for (; x <= w - 1 - vl; x += vl) {
+        cv::v_uint16 ul0, ul1, uc0, uc1, ur0, ur1, ml0, ml1, mr0, mr1, dl0, dl1, dc0, dc1, dr0, dr1;
+        cv::v_expand(cv::vx_load(u + x - 1), ul0, ul1);
+        cv::v_expand(cv::vx_load(u + x), uc0, uc1);
+        cv::v_expand(cv::vx_load(u + x + 1), ur0, ur1);
+        cv::v_expand(cv::vx_load(m + x - 1), ml0, ml1);
+        cv::v_expand(cv::vx_load(m + x + 1), mr0, mr1);
+        cv::v_expand(cv::vx_load(d + x - 1), dl0, dl1);
+        cv::v_expand(cv::vx_load(d + x), dc0, dc1);
+        cv::v_expand(cv::vx_load(d + x + 1), dr0, dr1);
+        const cv::v_uint8 edge = cv::v_pack(magnitude(ul0, uc0, ur0, ml0, mr0, dl0, dc0, dr0),
+                                            magnitude(ul1, uc1, ur1, ml1, mr1, dl1, dc1, dr1));
+        const cv::v_uint8 sub = cv::v_and(edge, darken);
+        if (cn == 3) {
+            cv::v_uint8 b, g, r;
+            cv::v_load_deinterleave(dst + 3 * x, b, g, r);
+            cv::v_store_interleave(dst + 3 * x, cv::v_sub(b, sub), cv::v_sub(g, sub), cv::v_sub(r, sub));
+        } else {
+            cv::v_store(dst + x, cv::v_sub(cv::vx_load(dst + x), sub));
+        }
+    }
+#endif
+    for (; x < w; ++x) scalarPixel(x);
+}
+
+void edgeHintFastStage(cv::Mat& small, RetroFilterContext& ws) {
+    CV_Assert(small.depth() == CV_8U && (small.channels() == 1 || small.channels() == 3));
+    const int w = small.cols, h = small.rows, cn = small.channels();
+
+    // Luma first (a copy for one channel), so the in-place darkening never
+    // feeds a neighbouring row's gradient. cvtColor's own BGR2GRAY, not the
+    // contrast stage's YCrCb luma: the two differ by a level here and
+    // there, and this way Fast and Canny threshold the same plane.
+    if (cn == 3) {
+        cv::cvtColor(small, ws.gray, cv::COLOR_BGR2GRAY);
+    } else {
+        small.copyTo(ws.gray);
+    }
+
+    forEachBand(h, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            fastEdgeRow(ws.gray.ptr<uchar>(reflect101(y - 1, h)), ws.gray.ptr<uchar>(y),
+                        ws.gray.ptr<uchar>(reflect101(y + 1, h)), small.ptr<uchar>(y), w, cn);
+        }
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+        cv::vx_cleanup();
+#endif
+    });
+}
+
+// ---------------------- Nearest-neighbour upscale ----------------------
+void NearestMap::build(cv::Size f, cv::Size t, int c) {
+    from = f;
+    to = t;
+    cn = c;
+    xc.resize(t.width);
+    sy.resize(t.height);
+    const double ifx = 1.0 / (double(t.width) / f.width);
+    const double ify = 1.0 / (double(t.height) / f.height);
+    for (int x = 0; x < t.width; ++x) xc[x] = std::min(cvFloor(x * ifx), f.width - 1) * c;
+    for (int y = 0; y < t.height; ++y) sy[y] = std::min(cvFloor(y * ify), f.height - 1);
+    scale = 0;
+    if (t.width % f.width == 0) {
+        scale = t.width / f.width;
+        for (int x = 0; x < t.width && scale > 0; ++x) {
+            if (xc[x] != x / scale * c) scale = 0;
+        }
+    }
+
+    // v_lut pattern for factors the zips do not cover: lane o of a block of
+    // scale vectors takes source pixel o / scale
+    spread.clear();
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    if (scale > 1) {
+        spread.resize(size_t(cv::VTraits<cv::v_uint8>::vlanes()) * scale);
+        for (size_t o = 0; o < spread.size(); ++o) spread[o] = int(o / scale);
+    }
+#endif
+
+    // First output column of every source column (the next one's if none)
+    first.assign(f.width + 1, t.width);
+    for (int x = t.width - 1; x >= 0; --x) first[xc[x] / c] = x;
+    for (int x = f.width - 1; x >= 0; --x) first[x] = std::min(first[x], first[x + 1]);
+
+    // Neighbours for the fused sharpen, and the columns next to a block edge
+    xl.resize(t.width);
+    xr.resize(t.width);
+    edges.clear();
+    for (int x = 0; x < t.width; ++x) {
+        xl[x] = xc[reflect101(x - 1, t.width)];
+        xr[x] = xc[reflect101(x + 1, t.width)];
+        if (xl[x] != xc[x] || xr[x] != xc[x]) edges.push_back(x);
+    }
+}
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+// Writes every lane of a (or of the b, g, r planes) S times: log2(S)
+// rounds of v_zip(a, a), S a power of two
+template <int S>
+struct Replicate {
+    static void gray(uchar* dst, const cv::v_uint8& a) {
+        cv::v_uint8 lo, hi;
+        cv::v_zip(a, a, lo, hi);
+        const int half = cv::VTraits<cv::v_uint8>::vlanes() * S / 2;
+        Replicate<S / 2>::gray(dst, lo);
+        Replicate<S / 2>::gray(dst + half, hi);
+    }
+    static void bgr(uchar* dst, const cv::v_uint8& b, const cv::v_uint8& g, const cv::v_uint8& r) {
+        cv::v_uint8 b0, b1, g0, g1, r0, r1;
+        cv::v_zip(b, b, b0, b1);
+        cv::v_zip(g, g, g0, g1);
+        cv::v_zip(r, r, r0, r1);
+        const int half = cv::VTraits<cv::v_uint8>::vlanes() * S / 2 * 3;
+        Replicate<S / 2>::bgr(dst, b0, g0, r0);
+        Replicate<S / 2>::bgr(dst + half, b1, g1, r1);
+    }
+};
+
+template <>
+struct Replicate<1> {
+    static void gray(uchar* dst, const cv::v_uint8& a) { cv::v_store(dst, a); }
+    static void bgr(uchar* dst, const cv::v_uint8& b, const cv::v_uint8& g, const cv::v_uint8& r) {
+        cv::v_store_interleave(dst, b, g, r);
+    }
+};
+
+// Vector part of replicateRow; returns the first source pixel not done
+template <int S>
+static int replicateRowSimd(const uchar* src, uchar* dst, int srcCols, int cn) {
+    const int vl = cv::VTraits<cv::v_uint8>::vlanes();
+    int x = 0;
+    if (cn == 3) {
+        for (; x <= srcCols - vl; x += vl) {
+            cv::v_uint8 b, g, r;
+            cv::v_load_deinterleave(src + 3 * x, b, g, r);
+            Replicate<S>::bgr(dst + 3 * x * S, b, g, r);
+        }
+    } else {
+        for (; x <= srcCols - vl; x += vl) Replicate<S>::gray(dst + x * S, cv::vx_load(src + x));
+    }
+    return x;
+}
+
+// Any other factor: each source vector becomes `scale` vectors gathered
+// through the NearestMap::spread pattern (planes for BGR)
+static int replicateRowLut(const uchar* src, uchar* dst, int srcCols, int cn, int scale, const int* spread) {
+    const int vl = cv::VTraits<cv::v_uint8>::vlanes();
+    int x = 0;
+    if (cn == 3) {
+        uchar pb[cv::VTraits<cv::v_uint8>::max_nlanes];
+        uchar pg[cv::VTraits<cv::v_uint8>::max_nlanes];
+        uchar pr[cv::VTraits<cv::v_uint8>::max_nlanes];
+        for (; x <= srcCols - vl; x += vl) {
+            cv::v_uint8 b, g, r;
+            cv::v_load_deinterleave(src + 3 * x, b, g, r);
+            cv::v_store(pb, b);
+            cv::v_store(pg, g);
+            cv::v_store(pr, r);
+            uchar* q = dst + size_t(x) * scale * 3;
+            for (int j = 0; j < scale; ++j, q += 3 * vl) {
+                const int* idx = spread + j * vl;
+                cv::v_store_interleave(q, cv::v_lut(pb, idx), cv::v_lut(pg, idx), cv::v_lut(pr, idx));
+            }
+        }
+    } else {
+        for (; x <= srcCols - vl; x += vl) {
+            uchar* q = dst + size_t(x) * scale;
+            for (int j = 0; j < scale; ++j, q += vl) cv::v_store(q, cv::v_lut(src + x, spread + j * vl));
+        }
+    }
+    return x;
+}
+#endif
+
+// One source row widened by an integer factor, each pixel written scale
+// times. Pure bandwidth: 2/4/8/16 are whole vectors of zipped lanes, other
+// factors one v_lut per output vector through `spread`.
+static void replicateRow(const uchar* src, uchar* dst, int srcCols, int cn, int scale, const int* spread) {
+    if (scale == 1) {
+        std::memcpy(dst, src, size_t(srcCols) * cn);
+        return;
+    }
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    switch (scale) {
+    case 2:  x = replicateRowSimd<2>(src, dst, srcCols, cn); break;
+    case 4:  x = replicateRowSimd<4>(src, dst, srcCols, cn); break;
+    case 8:  x = replicateRowSimd<8>(src, dst, srcCols, cn); break;
+    case 16: x = replicateRowSimd<16>(src, dst, srcCols, cn); break;
+    default: x = spread ? replicateRowLut(src, dst, srcCols, cn, scale, spread) : 0; break;
+    }
+#else
+    (void)spread;
+#endif
+    for (; x < srcCols; ++x) {
+        const uchar* p = src + x * cn;
+        uchar* q = dst + size_t(x) * scale * cn;
+        for (int i = 0; i < scale; ++i, q += cn) {
+            for (int k = 0; k < cn; ++k) q[k] = p[k];
+        }
+    }
+}
+
+// One output row of the upscale from its source row
+static void upscaleRow(const uchar* src, uchar* dst, int W, int cn, const NearestMap& map) {
+    if (map.scale > 0) {
+        replicateRow(src, dst, W / map.scale, cn, map.scale, map.spread.empty() ? nullptr : map.spread.data());
+    } else if (cn == 3) {
+        for (int x = 0; x < W; ++x, dst += 3) {
+            const uchar* p = src + map.xc[x];
+            dst[0] = p[0];
+            dst[1] = p[1];
+            dst[2] = p[2];
+        }
+    } else {
+        for (int x = 0; x < W; ++x) dst[x] = src[map.xc[x]];
+    }
+}
+
+// 6) Upscale back. Same pixels as cv::resize INTER_NEAREST: each source
+// row is widened once and its vertical repeats are memcpy'd.
+void upscaleStage(const cv::Mat& smallQ, cv::Mat& out, cv::Size size, RetroFilterContext& ws) {
+    const int cn = smallQ.channels();
+    if (smallQ.depth() != CV_8U || (cn != 1 && cn != 3) || smallQ.data == out.data) {
+        cv::resize(smallQ, out, size, 0, 0, cv::INTER_NEAREST);
+        return;
+    }
+
+    NearestMap& map = ws.upscaleMap;
+    if (!map.matches(smallQ.size(), size, cn)) map.build(smallQ.size(), size, cn);
+    out.create(size, smallQ.type());
+    forEachBand(size.height, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            uchar* dst = out.ptr<uchar>(y);
+            if (y > y0 && map.sy[y] == map.sy[y - 1]) {
+                std::memcpy(dst, out.ptr<uchar>(y - 1), size_t(size.width) * cn);
+            } else {
+                upscaleRow(smallQ.ptr<uchar>(map.sy[y]), dst, size.width, cn, map);
+            }
+        }
+    });
+}
+
+// 7) Light sharpen, in place
+void sharpenStage(cv::Mat& img, RetroFilterContext& ws) {
+    cv::GaussianBlur(img, ws.blurred, cv::Size(3, 3), 0);
+    cv::addWeighted(img, 1.15, ws.blurred, -0.15, 0.0, img);
+}
+
+// DMG preset: the same seven stages on one luma plane, a third of the
+// bytes of the BGR path per stage; only the output is colourised.
+static void runDmgFilter(const cv::Mat& inputBgr, cv::Mat& out, const RetroFilterOptions& opt,
+                         RetroFilterContext& ws) {
+    // 1) Luma and the contrast scale in one pass (Y as in YCrCb, * 1.10 + 4)
+    // 2) Downscale; lowResContrast swaps the two
+    const float a = 1.10f;
+    const cv::Matx14f toLuma(0.114f * a, 0.587f * a, 0.299f * a, 4.0f);
+    if (opt.lowResContrast) {
+        {
+            StageTimer timer(ws.timings, StageDownscale, ws.frameIndex);
+            downscaleStage(inputBgr, ws.small, opt.targetWidth);
+        }
+        StageTimer timer(ws.timings, StageContrast, ws.frameIndex);
+        cv::transform(ws.small, ws.lumaSmall, toLuma);
+    } else {
+        {
+            StageTimer timer(ws.timings, StageContrast, ws.frameIndex);
+            cv::transform(inputBgr, ws.luma, toLuma);
+        }
+        StageTimer timer(ws.timings, StageDownscale, ws.frameIndex);
+        downscaleStage(ws.luma, ws.lumaSmall, opt.targetWidth);
+    }
+
+    // 3) Edge hint straight on the luma plane
+    if (opt.addEdgeHint && opt.edgeHintMode == EdgeHintMode::Fast) {
+        StageTimer timer(ws.timings, StageEdgeHint, ws.frameIndex);
+        edgeHintFastStage(ws.lumaSmall, ws);
+    } else if (opt.addEdgeHint) {
+        StageTimer timer(ws.timings, StageEdgeHint, ws.frameIndex);
+        cv::Canny(ws.lumaSmall, ws.edges, 60, 140);
+        cv::dilate(ws.edges, ws.edgesDilated, cv::Mat(), cv::Point(-1, -1), 1);
+        ws.edgesDilated.convertTo(ws.halfEdges, CV_8U, 0.5);
+        cv::subtract(ws.lumaSmall, ws.halfEdges, ws.lumaSmall);
+    }
+
+    // 4+5) Dither and 4-shade quantize, one table read per pixel
+    {
+        StageTimer timer(ws.timings, StageDither, ws.frameIndex);
+        ditherDmgInto(ws.lumaSmall, ws.lumaQ, opt.ditherStrength, ws.dmgLut, ws.frameIndex);
+    }
+
+    // 6+7) Upscale and light sharpen in one pass, still one channel
+    {
+        StageTimer timer(ws.timings, StageUpscaleSharpen, ws.frameIndex);
+        upscaleSharpenStage(ws.lumaQ, ws.lumaOut, inputBgr.size(), ws);
+    }
+
+    // Colourise into the BGR output
+    {
+        StageTimer timer(ws.timings, StageColorize, ws.frameIndex);
+        colorizeDmgInto(ws.lumaOut, out, opt.dmgShades);
+    }
+}
+
+// ---------------------- Fused upscale + sharpen ----------------------
+// For CV_8U, GaussianBlur 3x3 (sigma 0) is OpenCV's bit-exact fixed-point
+// [1 2 1] x [1 2 1] / 16 with round-half-up, reflect-101 at the borders;
+// the addWeighted(1.15, -0.15) step is a table made by addWeighted itself.
+// Null if that table does not map (p, p) to p, which the interior
+// shortcut relies on; the stage then falls back to the two-pass version.
+static const uchar* sharpenTable() {
+    static const std::vector<uchar> table = [] {
+        cv::Mat pix(256, 256, CV_8U), blur(256, 256, CV_8U), t;
+        for (int i = 0; i < 256; ++i) {
+            for (int j = 0; j < 256; ++j) {
+                pix.at<uchar>(i, j) = (uchar)i;
+                blur.at<uchar>(i, j) = (uchar)j;
+            }
+        }
+        cv::addWeighted(pix, 1.15, blur, -0.15, 0.0, t);
+        std::vector<uchar> v(t.data, t.data + t.total());
+        for (int i = 0; i < 256; ++i) {
+            if (v[i * 257] != i) return std::vector<uchar>();
+        }
+        return v;
+    }();
+    return table.empty() ? nullptr : table.data();
+}
+
+// Full 3x3 sharpen of one output pixel; l/c/r are the byte offsets of its
+// left, own and right source pixel
+static inline void sharpenPixel(const uchar* u, const uchar* m, const uchar* d, uchar* dst, int cn,
+                                int l, int c, int r, const uchar* table) {
+    for (int k = 0; k < cn; ++k) {
+        const int S = (u[l + k] + 2 * u[c + k] + u[r + k])
+                    + 2 * (m[l + k] + 2 * m[c + k] + m[r + k])
+                    + (d[l + k] + 2 * d[c + k] + d[r + k]);
+        dst[k] = table[m[c + k] * 256 + ((S + 8) >> 4)];
+    }
+}
+
+// One output row from its three source rows (up, mid, down; may be the
+// same row). xl/xc/xr are byte offsets of each output pixel's left, own
+// and right source pixel.
+static void upscaleSharpenRow(const uchar* u, const uchar* m, const uchar* d, uchar* dst, int W, int cn,
+                              const int* xl, const int* xc, const int* xr, const uchar* table) {
+    for (int x = 0; x < W; ) {
+        const int c = xc[x];
+        if (xl[x] == c && xr[x] == c) {
+            // Inside a block horizontally: the blur is vertical only and the
+            // same for the whole run (and the identity if u == m == d)
+            uchar v[3];
+            for (int k = 0; k < cn; ++k) {
+                const int S = 4 * (u[c + k] + 2 * m[c + k] + d[c + k]);
+                v[k] = table[m[c + k] * 256 + ((S + 8) >> 4)];
+            }
+            do {
+                for (int k = 0; k < cn; ++k) dst[x * cn + k] = v[k];
+                ++x;
+            } while (x < W && xl[x] == c && xc[x] == c && xr[x] == c);
+        } else {
+            sharpenPixel(u, m, d, dst + x * cn, cn, xl[x], c, xr[x], table);
+            ++x;
+        }
+    }
+}
+
+void upscaleSharpenStage(const cv::Mat& smallQ, cv::Mat& out, cv::Size size, RetroFilterContext& ws) {
+    CV_Assert(smallQ.depth() == CV_8U && (smallQ.channels() == 1 || smallQ.channels() == 3));
+    const uchar* table = sharpenTable();
+    if (!table) {
+        upscaleStage(smallQ, out, size, ws);
+        sharpenStage(out, ws);
+        return;
+    }
+
+    const int cn = smallQ.channels();
+    const int W = size.width, H = size.height;
+    out.create(size, smallQ.type());
+
+    // Source pixel of every output pixel, its left/right neighbours' and
+    // the block-edge columns, kept between frames of the same size
+    NearestMap& map = ws.upscaleMap;
+    if (!map.matches(smallQ.size(), size, cn)) map.build(smallQ.size(), size, cn);
+    const std::vector<int>& xc = map.xc;
+    const std::vector<int>& xl = map.xl;
+    const std::vector<int>& xr = map.xr;
+    const std::vector<int>& sy = map.sy;
+
+    forEachBand(H, 0, [&](int y0, int y1) {
+        const uchar* prev[3] = { nullptr, nullptr, nullptr };
+        for (int y = y0; y < y1; ++y) {
+            const uchar* u = smallQ.ptr<uchar>(sy[reflect101(y - 1, H)]);
+            const uchar* m = smallQ.ptr<uchar>(sy[y]);
+            const uchar* d = smallQ.ptr<uchar>(sy[reflect101(y + 1, H)]);
+            uchar* dst = out.ptr<uchar>(y);
+            if (u == prev[0] && m == prev[1] && d == prev[2]) {
+                // Same source rows as the row above: same output
+                std::memcpy(dst, out.ptr<uchar>(y - 1), size_t(W) * cn);
+                continue;
+            }
+            prev[0] = u;
+            prev[1] = m;
+            prev[2] = d;
+            if (u == m && m == d) {
+                // Inside a block vertically: the plain upscaled row, except
+                // next to a block edge
+                upscaleRow(m, dst, W, cn, map);
+                for (int x : map.edges) sharpenPixel(u, m, d, dst + x * cn, cn, xl[x], xc[x], xr[x], table);
+            } else {
+                upscaleSharpenRow(u, m, d, dst, W, cn, xl.data(), xc.data(), xr.data(), table);
+            }
+        }
+    });
+}
+
+// ---------------------- Index-domain upscale + sharpen ----------------------
+// n indices -> n BGR palette colours. Up to 16 colours are selected a
+// vector at a time, one compare per palette entry.
+static void expandPaletteRow(const uchar* idx, uchar* dst, int n, const uchar* colors, int K) {
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    if (K <= 16) {
+        const int vl = cv::VTraits<cv::v_uint8>::vlanes();
+        for (; x <= n - vl; x += vl) {
+            const cv::v_uint8 i = cv::vx_load(idx + x);
+            cv::v_uint8 b = cv::vx_setall_u8(colors[0]);
+            cv::v_uint8 g = cv::vx_setall_u8(colors[1]);
+            cv::v_uint8 r = cv::vx_setall_u8(colors[2]);
+            for (int k = 1; k < K; ++k) {
+                const cv::v_uint8 hit = cv::v_eq(i, cv::vx_setall_u8((uchar)k));
+                b = cv::v_select(hit, cv::vx_setall_u8(colors[3 * k]), b);
+                g = cv::v_select(hit, cv::vx_setall_u8(colors[3 * k + 1]), g);
+                r = cv::v_select(hit, cv::vx_setall_u8(colors[3 * k + 2]), r);
+            }
+            cv::v_store_interleave(dst + 3 * x, b, g, r);
+        }
+    }
+#else
+    (void)K;
+#endif
+    for (dst += 3 * x; x < n; ++x, dst += 3) {
+        const uchar* c = colors + 3 * idx[x];
+        dst[0] = c[0];
+        dst[1] = c[1];
+        dst[2] = c[2];
+    }
+}
+
+void expandPalette(const cv::Mat& indices, const cv::Mat& palette, cv::Mat& out) {
+    CV_Assert(indices.type() == CV_8UC1);
+    CV_Assert(palette.type() == CV_8UC1 && palette.cols == 3 && palette.isContinuous());
+    out.create(indices.size(), CV_8UC3);
+    const uchar* colors = palette.ptr<uchar>(0);
+    for (int y = 0; y < indices.rows; ++y) {
+        expandPaletteRow(indices.ptr<uchar>(y), out.ptr<uchar>(y), indices.cols, colors, palette.rows);
+    }
+}
+
+void upscaleSharpenIndexedStage(const cv::Mat& indices, const cv::Mat& palette, cv::Mat& out, cv::Size size,
+                                RetroFilterContext& ws) {
+    CV_Assert(indices.type() == CV_8UC1);
+    CV_Assert(palette.type() == CV_8UC1 && palette.cols == 3 && palette.isContinuous());
+    const uchar* table = sharpenTable();
+    const int w = indices.cols, h = indices.rows;
+    const int W = size.width, H = size.height;
+    if (!table || W < w || H < h) {
+        // Downscaling output (the flat test below assumes every output
+        // neighbour maps to a small neighbour): expand first
+        expandPalette(indices, palette, ws.smallQ);
+        upscaleSharpenStage(ws.smallQ, out, size, ws);
+        return;
+    }
+    out.create(size, CV_8UC3);
+
+    // Flat small pixels: one index over the 3x3 (reflect-101). Output
+    // neighbours map to small neighbours when upscaling, so these blocks
+    // are the plain palette colour after the sharpen. The small image is
+    // expanded alongside (a fraction of the output); every output row
+    // starts as its replicated row.
+    std::vector<uchar>& flat = ws.flat;
+    flat.resize(size_t(w) * h);
+    ws.smallQ.create(indices.size(), CV_8UC3);
+    const uchar* colors = palette.ptr<uchar>(0);
+    forEachBand(h, 0, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uchar* u = indices.ptr<uchar>(reflect101(y - 1, h));
+            const uchar* m = indices.ptr<uchar>(y);
+            const uchar* d = indices.ptr<uchar>(reflect101(y + 1, h));
+            uchar* f = flat.data() + size_t(y) * w;
+            for (int x = 0; x < w; ++x) {
+                const int l = reflect101(x - 1, w), r = reflect101(x + 1, w);
+                const uchar v = m[x];
+                f[x] = (uchar)(u[l] == v && u[x] == v && u[r] == v && m[l] == v && m[r] == v &&
+                               d[l] == v && d[x] == v && d[r] == v);
+            }
+            expandPaletteRow(m, ws.smallQ.ptr<uchar>(y), w, colors, palette.rows);
+        }
+    });
+
+    NearestMap& map = ws.upscaleMap;
+    if (!map.matches(indices.size(), size, 3)) map.build(indices.size(), size, 3);
+    const std::vector<int>& xc = map.xc;
+    const std::vector<int>& xl = map.xl;
+    const std::vector<int>& xr = map.xr;
+    const std::vector<int>& sy = map.sy;
+
+    forEachBand(H, 0, [&](int y0, int y1) {
+        const uchar* prev[3] = { nullptr, nullptr, nullptr };
+        for (int y = y0; y < y1; ++y) {
+            const int su = sy[reflect101(y - 1, H)], sm = sy[y], sd = sy[reflect101(y + 1, H)];
+            const uchar* u = ws.smallQ.ptr<uchar>(su);
+            const uchar* m = ws.smallQ.ptr<uchar>(sm);
+            const uchar* d = ws.smallQ.ptr<uchar>(sd);
+            uchar* dst = out.ptr<uchar>(y);
+            if (u == prev[0] && m == prev[1] && d == prev[2]) {
+                std::memcpy(dst, out.ptr<uchar>(y - 1), size_t(W) * 3);
+                continue;
+            }
+            prev[0] = u;
+            prev[1] = m;
+            prev[2] = d;
+            upscaleRow(m, dst, W, 3, map);
+            const uchar* f = flat.data() + size_t(sm) * w;
+            if (u == m && m == d) {
+                // Inside a block vertically: only the block-edge columns
+                // that are not flat change
+                for (int x : map.edges) {
+                    if (!f[xc[x] / 3]) sharpenPixel(u, m, d, dst + 3 * x, 3, xl[x], xc[x], xr[x], table);
+                }
+            } else {
+                // Every output column of a small pixel that is not flat
+                for (int c = 0; c < w; ++c) {
+                    if (f[c]) continue;
+                    const int x0 = map.first[c], x1 = map.first[c + 1];
+                    upscaleSharpenRow(u, m, d, dst + 3 * x0, x1 - x0, 3, xl.data() + x0, xc.data() + x0,
+                                      xr.data() + x0, table);
+                }
+            }
+        }
+    });
+}
+
+// reusePalette: maps `img` through the palette of the previous fit (one cube
+// read per pixel) and keeps the result if its compactness per pixel is
+// within the bound a warm fit has to meet. False: fit this frame as usual.
+static bool reusePreviousPalette(const cv::Mat& img, const RetroFilterOptions& opt,
+                                 RetroFilterContext& ws, KMeansWarmStart* warm) {
+    if (!opt.reusePalette || !warm || opt.quantizer == QuantizeMode::Fixed) return false;
+    if (warm->refCompactness <= 0.0 || ws.quant.palette8.rows != opt.paletteColors) return false;
+
+    ws.reuseLut.update(ws.quant.palette8);
+    const double c = ws.reuseLut.applyIndicesMeasured(img, ws.smallIdx);
+    if (c / double(img.total()) > warm->refCompactness * warm->degradeRatio) return false;
+    warm->reusedFrames++;
+    return true;
+}
+
+// Shared implementation: options/warm/stats are passed separately so the
+// value-returning overloads can run on a temporary workspace.
+static void runRetroFilter(const cv::Mat& inputBgr, cv::Mat& out, const RetroFilterOptions& opt,
+                           RetroFilterContext& ws, KMeansWarmStart* warm, QuantizeStats* stats) {
+    CV_Assert(inputBgr.type() == CV_8UC3);
+
+    ws.timings = StageTimings();
+    if (opt.dmg) {
+        runDmgFilter(inputBgr, out, opt, ws);
+        return;
+    }
+
+    // 1) Mild contrast via luma scale
+    // 2) Downscale; lowResContrast swaps the two (contrast in place on the
+    // small image, so nothing but the downscale touches full resolution)
+    if (opt.lowResContrast) {
+        {
+            StageTimer timer(ws.timings, StageDownscale, ws.frameIndex);
+            downscaleStage(inputBgr, ws.small, opt.targetWidth);
+        }
+        StageTimer timer(ws.timings, StageContrast, ws.frameIndex);
+        contrastStage(ws.small, ws.small);
+    } else {
+        {
+            StageTimer timer(ws.timings, StageContrast, ws.frameIndex);
+            contrastStage(inputBgr, ws.bgr);
+        }
+        StageTimer timer(ws.timings, StageDownscale, ws.frameIndex);
+        downscaleStage(ws.bgr, ws.small, opt.targetWidth);
+    }
+
+    // 3) Edge hint
+    if (opt.addEdgeHint) {
+        StageTimer timer(ws.timings, StageEdgeHint, ws.frameIndex);
+        if (opt.edgeHintMode == EdgeHintMode::Fast) {
+            edgeHintFastStage(ws.small, ws);
+        } else {
+            edgeHintStage(ws.small, ws);
+        }
+    }
+
+    // 4+5) RGB555: dither and 5-bit snap in one pass, nothing to fit
+    if (opt.quantizer == QuantizeMode::Rgb555) {
+        StageTimer timer(ws.timings, StageDither, ws.frameIndex);
+        ditherRgb555Into(ws.small, ws.smallQ, opt.ditherStrength, ws.ditherRows, ws.frameIndex);
+    }
+
+    // 4) Dither (threaded into row bands on the worker pool)
+    const cv::Mat* dithered = &ws.small;
+    if (opt.quantizer != QuantizeMode::Rgb555 && opt.ditherStrength > 0) {
+        StageTimer timer(ws.timings, StageDither, ws.frameIndex);
+        applyOrderedDitherInto(ws.small, ws.dithered, opt.ditherStrength, ws.ditherRows, ws.frameIndex);
+        dithered = &ws.dithered;
+    }
+
+    // 5) Palette reduce to an index plane + palette (no BGR image)
+    const cv::Mat* palette = nullptr;
+    if (opt.quantizer != QuantizeMode::Rgb555) {
+        StageTimer timer(ws.timings, StageQuantize, ws.frameIndex);
+        palette = &ws.quant.palette8;
+        if (reusePreviousPalette(*dithered, opt, ws, warm)) {
+            palette = &ws.reuseLut.palette();
+        } else {
+            switch (opt.quantizer) {
+            case QuantizeMode::Histogram:
+                histogramQuantizeInto(*dithered, ws.smallIdx, opt.paletteColors, opt.histogramBits,
+                                      opt.kmeansAttempts, ws.quant, warm);
+                break;
+            case QuantizeMode::Subsample:
+                subsampleQuantizeInto(*dithered, ws.smallIdx, opt.paletteColors, opt.subsampleCount,
+                                      opt.kmeansAttempts, ws.quant, warm, stats, opt.validateSubsample);
+                break;
+            case QuantizeMode::Fixed:
+                // Nearest-colour cube is built once, then one read per pixel
+                ws.fixedLut.update(opt.fixedPalette);
+                ws.fixedLut.applyIndices(*dithered, ws.smallIdx);
+                palette = &ws.fixedLut.palette();
+                break;
+            case QuantizeMode::KMeans:
+            case QuantizeMode::Rgb555:
+            default:
+                kmeansQuantizeInto(*dithered, ws.smallIdx, opt.paletteColors, opt.kmeansAttempts,
+                                   ws.quant, warm);
+                break;
+            }
+        }
+    }
+
+    // 6+7) Upscale back and light sharpen, fused; indexed modes expand the
+    // palette at the small size and sharpen only around mixed indices
+    {
+        StageTimer timer(ws.timings, StageUpscaleSharpen, ws.frameIndex);
+        if (palette) {
+            upscaleSharpenIndexedStage(ws.smallIdx, *palette, out, inputBgr.size(), ws);
+        } else {
+            upscaleSharpenStage(ws.smallQ, out, inputBgr.size(), ws);
+        }
+    }
+}
+
+void gbaRetroFilter(const cv::Mat& inputBgr, cv::Mat& out, RetroFilterContext& ctx) {
+    CV_Assert(inputBgr.data != out.data || out.empty());
+    runRetroFilter(inputBgr, out, ctx.options, ctx, ctx.warmStart ? &ctx.warm : nullptr, &ctx.stats);
+}
+
+cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    const RetroFilterOptions& opt,
+    KMeansWarmStart* warm,
+    QuantizeStats* stats
+) {
+    RetroFilterContext ws;
+    cv::Mat out;
+    runRetroFilter(inputBgr, out, opt, ws, warm, stats);
+    return out;
+}
+
+cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    int targetWidth,
+    int paletteColors,
+    int ditherStrength,
+    bool addEdgeHint,
+    KMeansWarmStart* warm
+) {
+    RetroFilterOptions opt;
+    opt.targetWidth = targetWidth;
+    opt.paletteColors = paletteColors;
+    opt.ditherStrength = ditherStrength;
+    opt.addEdgeHint = addEdgeHint;
+    return gbaRetroFilter(inputBgr, opt, warm);
+}
@@ -0,0 +1,810 @@
+// retro_filter.hpp - GBA retro filter: threaded dithering, palette
+// quantizers and the gbaRetroFilter pipeline, shared by the video tool
+// (main.cpp) and the stage benchmarks (retro_bench.cpp)
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+// ---------------------- Trace export ----------------------
+// Chrome trace-event spans (load in chrome://tracing or ui.perfetto.dev).
+// Nothing is recorded until a TraceLog is installed with setActive(); until
+// then a TraceSpan costs one atomic load. -DRETRO_STAGE_TIMERS=0 compiles
+// the spans out together with the stage timers.
+#ifndef RETRO_STAGE_TIMERS
+#define RETRO_STAGE_TIMERS 1
+#endif
+
+using TraceClock = std::chrono::steady_clock;
+
+class TraceLog {
+public:
+    TraceLog() : origin(TraceClock::now()), serial(nextSerial().fetch_add(1) + 1) {}
+
+    static TraceLog* active() { return activeLog().load(std::memory_order_acquire); }
+    static void setActive(TraceLog* log) { activeLog().store(log, std::memory_order_release); }
+
+    // Small, stable per-thread id used as the trace "tid"
+    static int threadId() {
+        static std::atomic<int> next{1};
+        thread_local const int id = next.fetch_add(1);
+        return id;
+    }
+
+    // Label shown for the calling thread in the viewer
+    void nameThread(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mtx);
+        threadNames[threadId()] = name;
+    }
+
+    // Default label for the calling thread, for threads that outlive any one
+    // log (the worker pool). It is copied into whichever log receives the
+    // thread's first event, unless nameThread() already named it there.
+    static void labelThread(const char* label) { threadLabel() = label; }
+
+    // name must outlive the log (string literals)
+    void add(const char* name, int frame, TraceClock::time_point begin, TraceClock::time_point end) {
+        const Event e = { name, frame, threadId(), begin, end };
+        // By serial, not address: a later log may reuse a freed one's address
+        thread_local unsigned labelledIn = 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (labelledIn != serial && threadLabel()) {
+            threadNames.emplace(e.tid, threadLabel());
+            labelledIn = serial;
+        }
+        events.push_back(e);
+    }
+
+    bool write(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::ofstream f(path);
+        if (!f) return false;
+        f << std::fixed << std::setprecision(3);
+
+        f << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& tn : threadNames) {
+            f << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+              << tn.first << ", \"args\": {\"name\": \"" << tn.second << "\"}}";
+            first = false;
+        }
+        for (const Event& e : events) {
+            const std::chrono::duration<double, std::micro> ts = e.begin - origin, dur = e.end - e.begin;
+            f << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"retro\", \"ph\": \"X\", \"ts\": "
+              << ts.count() << ", \"dur\": " << dur.count() << ", \"pid\": 1, \"tid\": " << e.tid;
+            if (e.frame >= 0) f << ", \"args\": {\"frame\": " << e.frame << "}";
+            f << "}";
+            first = false;
+        }
+        f << "\n]}\n";
+        return bool(f);
+    }
+
+private:
+    struct Event {
+        const char* name;
+        int frame;  // -1: not tied to a frame
+        int tid;
+        TraceClock::time_point begin, end;
+    };
+
+    static std::atomic<TraceLog*>& activeLog() {
+        static std::atomic<TraceLog*> log{nullptr};
+        return log;
+    }
+
+    static std::atomic<unsigned>& nextSerial() {
+        static std::atomic<unsigned> next{0};
+        return next;
+    }
+
+    static const char*& threadLabel() {
+        thread_local const char* label = nullptr;
+        return label;
+    }
+
+    TraceClock::time_point origin;
+    unsigned serial;  // never 0
+    mutable std::mutex mtx;
+    std::vector<Event> events;
+    std::map<int, std::string> threadNames;
+};
+
+// Scoped: records [construction, destruction) on the active TraceLog
+class TraceSpan {
+public:
+#if RETRO_STAGE_TIMERS
+    TraceSpan(const char* name, int frame) : name(name), frame(frame), log(TraceLog::active()) {
+        if (log) begin = TraceClock::now();
+    }
+
+    ~TraceSpan() {
+        if (log) log->add(name, frame, begin, TraceClock::now());
+    }
+#else
+    TraceSpan(const char*, int) {}
+#endif
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+#if RETRO_STAGE_TIMERS
+private:
+    const char* name;
+    int frame;
+    TraceLog* log;
+    TraceClock::time_point begin;
+#endif
+};
+
+// ---------------------- Worker pool ----------------------
+// Threads are started once and reused for every frame, so dithering
+// costs a wake-up per band instead of a thread spawn. parallelFor()
+// also runs bands on the calling thread, which means the work still
+// completes (serially) if no worker thread could be created.
+// A call allocates nothing: the body is reached through a plain function
+// pointer and the job lives in one of a fixed set of slots, which workers
+// claim under the pool mutex. With every slot taken (more concurrent
+// callers than MAX_JOBS) the caller runs its bands alone.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) {
+            try {
+                workers.emplace_back([this] { workerLoop(); });
+            } catch (const std::system_error& e) {
+                std::cerr << "Failed to create worker thread " << i << ": " << e.what() << "\n";
+                break;
+            }
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cvTask.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size(); }
+
+    // Runs body(i) for every i in [0, count) and returns when all are done.
+    template <typename Fn>
+    void parallelFor(int count, const Fn& body) {
+        run(count, [](const void* fn, int i) { (*static_cast<const Fn*>(fn))(i); }, &body);
+    }
+
+private:
+    static const int MAX_JOBS = 32;
+
+    // Fields other than `next` are guarded by mtx
+    struct Job {
+        void (*call)(const void*, int) = nullptr;
+        const void* fn = nullptr;
+        int count = 0;
+        std::atomic<int> next{0};
+        int wanted = 0;     // helper requests no worker has claimed yet
+        int active = 0;     // workers inside work() for this job
+        bool busy = false;  // slot owned by a running parallelFor
+    };
+
+    static void work(Job& job) {
+        int i;
+        while ((i = job.next.fetch_add(1)) < job.count) job.call(job.fn, i);
+    }
+
+    void run(int count, void (*call)(const void*, int), const void* fn) {
+        if (count <= 0) return;
+
+        Job* job = nullptr;
+        const int helpers = std::min(count - 1, size());
+        if (helpers > 0) {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (Job& j : jobs) {
+                if (!j.busy) {
+                    job = &j;
+                    break;
+                }
+            }
+            if (job) {
+                job->busy = true;
+                job->call = call;
+                job->fn = fn;
+                job->count = count;
+                job->next.store(0);
+                job->wanted = helpers;
+                job->active = 0;
+                wanted += helpers;
+            }
+        }
+        if (!job) {
+            for (int i = 0; i < count; ++i) call(fn, i);
+            return;
+        }
+        for (int h = 0; h < helpers; ++h) cvTask.notify_one();
+
+        work(*job);
+
+        // Every index is taken: withdraw the requests no worker claimed and
+        // wait for the workers still running a body before freeing the slot
+        std::unique_lock<std::mutex> lock(mtx);
+        wanted -= job->wanted;
+        job->wanted = 0;
+        cvIdle.wait(lock, [&] { return job->active == 0; });
+        job->busy = false;
+    }
+
+    void workerLoop() {
+        // The pool is created on first use, usually before --trace installs
+        // a log, so the name is attached lazily on the first span
+        TraceLog::labelThread("pool worker");
+        for (;;) {
+            Job* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cvTask.wait(lock, [this] { return stopping || wanted > 0; });
+                if (wanted == 0) return;
+                for (Job& j : jobs) {
+                    if (j.wanted > 0) {
+                        job = &j;
+                        break;
+                    }
+                }
+                job->wanted--;
+                job->active++;
+                wanted--;
+            }
+            work(*job);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (--job->active > 0) continue;
+            }
+            cvIdle.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    Job jobs[MAX_JOBS];
+    int wanted = 0;                 // sum of Job::wanted
+    std::mutex mtx;
+    std::condition_variable cvTask, cvIdle;
+    bool stopping = false;
+};
+
+// One pool for the whole process, sized hardware_concurrency() - 1: the
+// caller of parallelFor() is the extra thread.
+ThreadPool& workerPool();
+
+// ---------------------- Dither offset rows ----------------------
+// The Bayer offset only depends on (x & 7, y & 7) and strength, so the 8
+// row phases are expanded once per call into full-width interleaved BGR
+// rows. A signed offset is stored as a (plus, minus) pair of u8 rows:
+// sat_sub(sat_add(p, plus), minus) == clampU8(p + offset) for every p,
+// which keeps the vector kernel bit-exact with the scalar loop.
+struct DitherRows {
+    int width = 0;                 // pixels per row
+    int strength = -1;             // strength the rows were built for
+    std::vector<uchar> plus;       // [8][width * 3]
+    std::vector<uchar> minus;      // [8][width * 3]
+
+    bool matches(int s, int w) const { return strength == s && width == w; }
+
+    void build(int s, int w);
+
+    const uchar* plusRow(int y) const  { return plus.data()  + size_t(y & 7) * width * 3; }
+    const uchar* minusRow(int y) const { return minus.data() + size_t(y & 7) * width * 3; }
+};
+
+// ---------------------- Threaded dithering ----------------------
+// Dithers bgr into out (which may be bgr itself). `rows` is rebuilt only
+// when the strength or width changes, so a caller that keeps it around
+// pays for the offset rows once. traceFrame tags the per-band trace spans;
+// maxThreads > 0 caps the number of bands (and so threads) used.
+void applyOrderedDitherInto(const cv::Mat& bgr, cv::Mat& out, int strength, DitherRows& rows,
+                            int traceFrame = -1, int maxThreads = 0);
+
+cv::Mat applyOrderedDither(const cv::Mat& bgr, int strength);
+
+// ---------------------- RGB555 hardware colour ----------------------
+// The GBA shows 15-bit BGR555. Dithers and snaps every channel to 5 bits in
+// the same pass: the dithered value is rounded to the nearest multiple of 8
+// and its top 3 bits are copied into the low 3 (c5 << 3 | c5 >> 2, as the
+// hardware expands it), so 0 and 255 stay reachable. No palette is fitted
+// and a pixel's output depends only on its value and position, which keeps
+// video free of palette flicker. strength may be 0 (plain rounding); 8 is
+// one 5-bit step. Parameters as in applyOrderedDitherInto.
+void ditherRgb555Into(const cv::Mat& bgr, cv::Mat& out, int strength, DitherRows& rows,
+                      int traceFrame = -1, int maxThreads = 0);
+
+// ---------------------- DMG 4-shade (single channel) ----------------------
+// Dither + 4-level quantization of a luma plane as one table read per
+// pixel. The table is indexed by Bayer cell and input value, so it holds
+// the dither offset, the clamp and the rounding to {0, 85, 170, 255}.
+struct DmgShadeLUT {
+    int strength = -1;           // strength the table was built for
+    std::vector<uchar> table;    // [64 Bayer cells][256 values]
+
+    void build(int s);
+};
+
+// luma (CV_8U) -> 4-shade luma; strength 0 only rounds. Parameters as in
+// applyOrderedDitherInto.
+void ditherDmgInto(const cv::Mat& luma, cv::Mat& out, int strength, DmgShadeLUT& lut,
+                   int traceFrame = -1, int maxThreads = 0);
+
+// 4-shade luma (CV_8U, possibly sharpened) -> BGR through `shades`,
+// darkest first. Levels between the shades blend linearly, so the
+// sharpen overshoot stays a tint of the neighbouring shade.
+void colorizeDmgInto(const cv::Mat& luma, cv::Mat& out, const cv::Vec3b shades[4]);
+
+// ---------------------- Nearest-neighbour map ----------------------
+// Output -> source mapping of cv::resize with INTER_NEAREST (floor of the
+// scaled coordinate, clamped) for one (small size, output size, channels),
+// columns as byte offsets. scale is the horizontal factor when every column
+// is exactly x / scale (960 -> 240, 1920 -> 240, ...), else 0 and rows are
+// gathered through xc. Rebuilt only when the sizes change.
+struct NearestMap {
+    cv::Size from, to;             // sizes the map was built for
+    int cn = 0;
+    std::vector<int> xc;           // [to.width] source byte offset
+    std::vector<int> sy;           // [to.height] source row
+    std::vector<int> xl, xr;       // [to.width] left/right neighbour's xc (reflect-101)
+    std::vector<int> edges;        // columns whose neighbours have another source
+    std::vector<int> first;        // [from.width + 1] first output column of each source column
+    std::vector<int> spread;       // [vlanes * scale] o / scale, v_lut pattern of replicateRow
+    int scale = 0;
+
+    bool matches(cv::Size f, cv::Size t, int c) const { return from == f && to == t && cn == c; }
+
+    void build(cv::Size f, cv::Size t, int c);
+};
+
+// ---------------------- Palette lookup cube ----------------------
+// Maps a BGR colour to a palette index with a single table read. The cube
+// is indexed by the top `bits` bits of each channel (5 -> 32^3 cells,
+// 6 -> 64^3) and every cell holds the palette entry nearest to the cell
+// centre, not to the pixel. A lookup is therefore approximate: it only
+// differs from a full nearest search for colours within half a cell of the
+// boundary between two palette entries, and the colour it picks is never
+// more than twice the pixel-to-centre distance (2 * sqrt(3) * 2^(7-bits))
+// farther away than the nearest one. retro_bench --validate measures both.
+class PaletteLUT {
+public:
+    explicit PaletteLUT(int bitsPerChannel = 5) : bits(bitsPerChannel) {
+        CV_Assert(bits >= 4 && bits <= 6);
+    }
+
+    // Rebuilds the cube only when `palette` (Kx3 CV_8U, BGR) differs from
+    // the one it was built for, so a reused palette costs nothing.
+    void update(const cv::Mat& palette) {
+        CV_Assert(palette.type() == CV_8UC1 && palette.cols == 3);
+        CV_Assert(palette.rows >= 1 && palette.rows <= 256);
+
+        bool same = !pal.empty() && pal.rows == palette.rows;
+        for (int k = 0; same && k < pal.rows; ++k) {
+            same = std::equal(pal.ptr<uchar>(k), pal.ptr<uchar>(k) + 3, palette.ptr<uchar>(k));
+        }
+        if (same) return;
+        pal = palette.clone();
+        build();
+    }
+
+    // bgr -> nearest palette colour, one lookup per pixel
+    void apply(const cv::Mat& bgr, cv::Mat& out) const {
+        CV_Assert(bgr.type() == CV_8UC3 && !pal.empty());
+        out.create(bgr.size(), CV_8UC3);
+
+        const uchar* colors = pal.ptr<uchar>(0);
+        forEachRow(bgr.rows, [&](int y) {
+            const uchar* s = bgr.ptr<uchar>(y);
+            uchar* d = out.ptr<uchar>(y);
+            for (int x = 0; x < bgr.cols; ++x, s += 3, d += 3) {
+                const uchar* c = colors + 3 * cube[cellOf(s)];
+                d[0] = c[0];
+                d[1] = c[1];
+                d[2] = c[2];
+            }
+        });
+    }
+
+    // bgr -> palette index plane (CV_8U)
+    void applyIndices(const cv::Mat& bgr, cv::Mat& indices) const {
+        CV_Assert(bgr.type() == CV_8UC3 && !pal.empty());
+        indices.create(bgr.size(), CV_8UC1);
+
+        forEachRow(bgr.rows, [&](int y) {
+            const uchar* s = bgr.ptr<uchar>(y);
+            uchar* d = indices.ptr<uchar>(y);
+            for (int x = 0; x < bgr.cols; ++x, s += 3) d[x] = cube[cellOf(s)];
+        });
+    }
+
+    // applyIndices, also returning the sum over all pixels of the squared
+    // distance to the colour they were mapped to (a fit's compactness)
+    double applyIndicesMeasured(const cv::Mat& bgr, cv::Mat& indices) {
+        CV_Assert(bgr.type() == CV_8UC3 && !pal.empty());
+        indices.create(bgr.size(), CV_8UC1);
+        rowError.resize(bgr.rows);
+
+        const uchar* colors = pal.ptr<uchar>(0);
+        forEachRow(bgr.rows, [&](int y) {
+            const uchar* s = bgr.ptr<uchar>(y);
+            uchar* d = indices.ptr<uchar>(y);
+            int64_t err = 0;
+            for (int x = 0; x < bgr.cols; ++x, s += 3) {
+                const int k = cube[cellOf(s)];
+                const uchar* c = colors + 3 * k;
+                const int db = s[0] - c[0], dg = s[1] - c[1], dr = s[2] - c[2];
+                err += db * db + dg * dg + dr * dr;
+                d[x] = (uchar)k;
+            }
+            rowError[y] = err;
+        });
+
+        int64_t total = 0;
+        for (int y = 0; y < bgr.rows; ++y) total += rowError[y];
+        return double(total);
+    }
+
+    const cv::Mat& palette() const { return pal; }
+    int bitsPerChannel() const { return bits; }
+    int buildCount() const { return builds; }
+
+private:
+    inline int cellOf(const uchar* p) const {
+        const int shift = 8 - bits;
+        return ((p[0] >> shift) << (2 * bits)) | ((p[1] >> shift) << bits) | (p[2] >> shift);
+    }
+
+    template <typename Fn>
+    static void forEachRow(int rows, const Fn& fn) {
+        ThreadPool& pool = workerPool();
+        const int bands = std::min(rows, pool.size() + 1);
+        if (bands <= 0) return;
+        const int rowsPerBand = (rows + bands - 1) / bands;
+        pool.parallelFor(bands, [&](int i) {
+            const int y1 = std::min(rows, (i + 1) * rowsPerBand);
+            for (int y = i * rowsPerBand; y < y1; ++y) fn(y);
+        });
+    }
+
+    void build() {
+        const int n = 1 << bits;
+        const int shift = 8 - bits;
+        const int half = 1 << (shift - 1);
+        const int K = pal.rows;
+        const uchar* colors = pal.ptr<uchar>(0);
+
+        cube.resize(size_t(n) * n * n);
+        forEachRow(n, [&](int bi) {
+            const int b = (bi << shift) + half;
+            for (int gi = 0; gi < n; ++gi) {
+                const int g = (gi << shift) + half;
+                uchar* cell = cube.data() + (size_t(bi) * n + gi) * n;
+                for (int ri = 0; ri < n; ++ri) {
+                    const int r = (ri << shift) + half;
+                    int best = 0, bestD = INT_MAX;
+                    for (int k = 0; k < K; ++k) {
+                        const int db = b - colors[3 * k + 0];
+                        const int dg = g - colors[3 * k + 1];
+                        const int dr = r - colors[3 * k + 2];
+                        const int d = db * db + dg * dg + dr * dr;
+                        if (d < bestD) { bestD = d; best = k; }
+                    }
+                    cell[ri] = (uchar)best;
+                }
+            }
+        });
+        ++builds;
+    }
+
+    int bits;
+    cv::Mat pal;               // Kx3 CV_8U, BGR
+    std::vector<uchar> cube;   // (1 << 3 * bits) palette indices
+    std::vector<int64_t> rowError;
+    int builds = 0;
+};
+
+// Applies a known palette without clustering, one cube read per pixel
+// (approximate, see PaletteLUT). The cube in `lut` is built lazily for
+// this palette and kept until a different palette is passed.
+cv::Mat quantizeToPalette(const cv::Mat& bgr, const cv::Mat& palette, PaletteLUT& lut);
+
+// ---------------------- Fixed palettes ----------------------
+// Console presets and palette files for QuantizeMode::Fixed. `spec` is a
+// preset name (see paletteNames(): gb, gbc, nes, pico8, cga, cga4) or the
+// path of a GIMP .gpl, Adobe .act or one-colour-per-line .hex file.
+// Duplicate colours are dropped. On success `palette` is Kx3 CV_8U (BGR,
+// 1 <= K <= 256); on failure it is left empty and `error` says why.
+bool loadPalette(const std::string& spec, cv::Mat& palette, std::string* error = nullptr);
+std::vector<std::string> paletteNames();
+
+// ---------------------- Warm-started k-means (video) ----------------------
+// Consecutive frames have nearly identical palettes, so a frame can start
+// Lloyd iterations from the previous frame's centers with one attempt.
+// A full k-means++ fit (with the caller's attempts) is re-run on the first
+// frame, when K changes, or when the warm fit's compactness per sample
+// grows past degradeRatio times that of the last full fit (scene cut).
+struct KMeansWarmStart {
+    cv::Mat centers;              // Kx3 CV_32F from the previous frame
+    double refCompactness = 0.0;  // per-sample compactness of the last full fit
+    double degradeRatio = 1.25;   // allowed growth before a full refit
+    int warmFits = 0;
+    int fullFits = 0;
+    int reusedFrames = 0;         // RetroFilterOptions::reusePalette, no fit at all
+};
+
+// ---------------------- Quantizer scratch ----------------------
+// Buffers the quantizers reuse from call to call. The value-returning
+// wrappers create a temporary one; RetroFilterContext keeps one per stream.
+struct WeightedPoints {
+    std::vector<float> pts;   // M x 3 (bin mean colour, BGR)
+    std::vector<float> wts;   // M
+    int size() const { return (int)wts.size(); }
+};
+
+struct QuantizeScratch {
+    cv::Mat samples, labels, centers, palette8;    // cv::kmeans paths
+    cv::Mat trial;                                 // histogram: per-attempt centers
+    std::vector<uint32_t> count, sums;             // histogram bins
+    std::vector<int> binPoint, pointLabels, trialLabels;
+    WeightedPoints wp;
+    std::vector<double> sum, wsum, d2, score;      // Lloyd / k-means++
+    std::vector<float> dist;
+    std::vector<float> rowBuf;                     // subsample: planar rows per band
+};
+
+// ---------------------- Quantizers ----------------------
+// paletteOut (optional) receives the Kx3 CV_8U centers, e.g. to apply the
+// same palette to other images through quantizeToPalette().
+// warm (optional, video) carries centers between frames, see KMeansWarmStart.
+cv::Mat kmeansQuantize(const cv::Mat& bgr, int K, int attempts = 3,
+                       cv::Mat* paletteOut = nullptr, KMeansWarmStart* warm = nullptr);
+
+// Fit quality of the last subsampleQuantize call
+struct QuantizeStats {
+    double compactness = 0.0;           // sum of squared distances, all pixels
+    double referenceCompactness = 0.0;  // full-image cv::kmeans (validation only)
+};
+
+// Fits the palette on a deterministic, evenly spread sample of at most
+// sampleCount pixels (one random pixel per stride), then assigns every
+// pixel to the fitted centers in one vectorised pass. Fitting cost is
+// bounded by sampleCount no matter how large the small image is.
+cv::Mat subsampleQuantize(const cv::Mat& bgr, int K, int sampleCount = 6000, int attempts = 3,
+                          cv::Mat* paletteOut = nullptr, KMeansWarmStart* warm = nullptr,
+                          QuantizeStats* stats = nullptr, bool validate = false);
+
+// Weighted k-means over a `bits`-per-channel colour histogram
+cv::Mat histogramQuantize(const cv::Mat& bgr, int K, int bits = 5, int attempts = 3,
+                          cv::Mat* paletteOut = nullptr, KMeansWarmStart* warm = nullptr);
+
+// ---------------------- Filter options ----------------------
+enum class QuantizeMode {
+    KMeans,      // cv::kmeans over every pixel of the small image
+    Histogram,   // weighted k-means over a reduced colour histogram
+    Subsample,   // cv::kmeans on a fixed-size sample, vectorised assignment
+    Rgb555,      // fixed 15-bit hardware colour, fused into the dither pass
+    Fixed        // nearest colour of RetroFilterOptions::fixedPalette
+};
+
+enum class EdgeHintMode {
+    Canny,       // Canny(60, 140) + dilate, as version 1
+    Fast         // one Sobel-threshold + darken pass (edgeHintFastStage)
+};
+
+struct RetroFilterOptions {
+    int targetWidth = 240;
+    int paletteColors = 16;
+    int ditherStrength = 18;
+    bool addEdgeHint = true;
+    EdgeHintMode edgeHintMode = EdgeHintMode::Canny;
+    QuantizeMode quantizer = QuantizeMode::KMeans;
+    int kmeansAttempts = 3;
+    int histogramBits = 5;     // Histogram: bits per channel (4..6)
+    int subsampleCount = 6000; // Subsample: pixels used to fit the palette
+    bool validateSubsample = false; // Subsample: also fit all pixels (slow)
+    // Video with warm start (KMeans, Histogram, Subsample): first map the
+    // frame through the previous frame's palette with the context's
+    // PaletteLUT, and keep that result without fitting when its compactness
+    // per pixel stays within the warm-start bound (KMeansWarmStart). Frames
+    // that drift past it are fitted as usual.
+    bool reusePalette = false;
+    cv::Mat fixedPalette;      // Fixed: Kx3 CV_8U BGR, see loadPalette()
+    // Downscale first and run the contrast on the small image, so only the
+    // downscale reads full resolution. Contrast clips near white, so where
+    // a downscale box mixes clipped and unclipped pixels the two orders
+    // differ: at most 28 levels per channel, about 1 on smooth content
+    // (retro_bench --validate measures it).
+    bool lowResContrast = false;
+    // Game Boy (DMG) preset: the whole chain runs on one luma plane with a
+    // fixed 4-shade quantizer (quantizer and paletteColors are ignored);
+    // colour only appears when the output is colourised through dmgShades.
+    bool dmg = false;
+    cv::Vec3b dmgShades[4] = {   // BGR, darkest first: the classic green LCD
+        cv::Vec3b(15, 56, 15), cv::Vec3b(48, 98, 48),
+        cv::Vec3b(15, 172, 139), cv::Vec3b(15, 188, 155)
+    };
+};
+
+// ---------------------- Stage timers ----------------------
+// Wall-clock time of each gbaRetroFilter stage, per call; each stage is
+// also a trace span. Build with -DRETRO_STAGE_TIMERS=0 to compile the
+// timers out entirely. Upscale and sharpen are one fused pass; colorize
+// is the DMG preset's shade lookup (0 on the BGR path), and with rgb555
+// the quantize is part of the dither.
+
+enum FilterStage {
+    StageContrast, StageDownscale, StageEdgeHint, StageDither,
+    StageQuantize, StageUpscaleSharpen, StageColorize, StageCount
+};
+
+static const char* const STAGE_NAMES[StageCount] = {
+    "contrast", "downscale", "edge_hint", "dither", "quantize", "upscale_sharpen", "colorize"
+};
+
+struct StageTimings {
+    double ms[StageCount] = {};  // skipped stages stay 0
+
+    double total() const {
+        double t = 0.0;
+        for (double v : ms) t += v;
+        return t;
+    }
+};
+
+// Scoped: adds the elapsed time to timings.ms[stage] when it goes out of
+// scope, and emits a span tagged with `frame` if tracing is on
+class StageTimer {
+public:
+#if RETRO_STAGE_TIMERS
+    StageTimer(StageTimings& timings, FilterStage stage, int frame)
+        : timings(timings), stage(stage), frame(frame), start(TraceClock::now()) {}
+
+    ~StageTimer() {
+        const TraceClock::time_point end = TraceClock::now();
+        const std::chrono::duration<double, std::milli> elapsed = end - start;
+        timings.ms[stage] += elapsed.count();
+        if (TraceLog* log = TraceLog::active()) log->add(STAGE_NAMES[stage], frame, start, end);
+    }
+#else
+    StageTimer(StageTimings&, FilterStage, int) {}
+#endif
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+#if RETRO_STAGE_TIMERS
+private:
+    StageTimings& timings;
+    FilterStage stage;
+    int frame;
+    TraceClock::time_point start;
+#endif
+};
+
+// ---------------------- Filter workspace ----------------------
+// Owns every intermediate buffer of gbaRetroFilter plus the per-stream
+// state (options, warm-start palette, quantizer stats). Buffers are sized
+// on the first frame and reused afterwards (cv::Mat::create is a no-op
+// when size and type match), and pool dispatch allocates nothing, so in
+// steady state the filter's own code makes no heap allocations. That is
+// not the whole process: scratch that OpenCV allocates inside cv::kmeans,
+// cv::Canny and the resize/blur kernels is outside its control, and only
+// the histogram quantizer avoids cv::kmeans entirely (subsample still runs
+// it, on its fixed-size sample). retro_bench --validate counts the
+// operator new calls per frame.
+// Not thread-safe: use one context per thread / stream.
+struct RetroFilterContext {
+    RetroFilterOptions options;
+    bool warmStart = false;        // carry k-means centers between calls
+    KMeansWarmStart warm;
+    QuantizeStats stats;           // last call (subsample mode)
+    StageTimings timings;          // last call
+    int frameIndex = -1;           // tags trace spans; set by the caller
+
+    // 1) contrast
+    cv::Mat bgr;
+    // 2) downscale, 4) dither
+    cv::Mat small, dithered;
+    DitherRows ditherRows;
+    // 3) edge hint
+    cv::Mat gray, edges, edgesDilated, edgesBgr, halfEdges;
+    // 5) palette
+    QuantizeScratch quant;
+    PaletteLUT fixedLut{6};        // Fixed: built on the first frame
+    PaletteLUT reuseLut{6};        // reusePalette: the last fitted palette
+    cv::Mat smallIdx;              // palette index per pixel (CV_8U)
+    cv::Mat smallQ;                // Rgb555 (or an expanded palette): BGR
+    // 6) upscale: source map for the current frame size, and the flat mask
+    // of the index-domain sharpen (one byte per small pixel)
+    NearestMap upscaleMap;
+    std::vector<uchar> flat;
+    // 7) sharpen
+    cv::Mat blurred;
+    // DMG preset: single-channel intermediates
+    cv::Mat luma, lumaSmall, lumaQ, lumaOut;
+    DmgShadeLUT dmgLut;
+
+    RetroFilterContext() = default;
+    explicit RetroFilterContext(const RetroFilterOptions& opt) : options(opt) {}
+};
+
+// ---------------------- GBA filter ----------------------
+// Reusable-workspace entry point for frame loops: `out` and every buffer in
+// `ctx` keep their storage between calls. in and out must not alias.
+void gbaRetroFilter(const cv::Mat& inputBgr, cv::Mat& out, RetroFilterContext& ctx);
+
+// warm (optional, video): seed k-means from the previous frame's palette
+// stats (optional): quantizer compactness, see QuantizeStats
+cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    const RetroFilterOptions& opt,
+    KMeansWarmStart* warm = nullptr,
+    QuantizeStats* stats = nullptr
+);
+
+cv::Mat gbaRetroFilter(
+    const cv::Mat& inputBgr,
+    int targetWidth = 240,
+    int paletteColors = 16,
+    int ditherStrength = 18,
+    bool addEdgeHint = true,
+    KMeansWarmStart* warm = nullptr
+);
+
+// Single stages as gbaRetroFilter runs them, using the buffers in `ws`
+// (exposed for retro_bench). Dither and quantize are the functions above.
+// contrastStage is a single fused pass, within 1 LSB of the YCrCb round
+// trip in reference_v1.hpp (retro_bench --validate checks every colour).
+void contrastStage(const cv::Mat& inputBgr, cv::Mat& out);
+void downscaleStage(const cv::Mat& bgr, cv::Mat& small, int targetWidth);
+void edgeHintStage(cv::Mat& small, RetroFilterContext& ws);
+// EdgeHintMode::Fast on 1 or 3 channels: the same BGR2GRAY luma as Canny
+// mode (into ws.gray), then Sobel |gx| + |gy| >= 140 darkens by 128, SIMD
+// and banded over the pool
+void edgeHintFastStage(cv::Mat& small, RetroFilterContext& ws);
+// Same pixels as cv::resize INTER_NEAREST; integer width ratios replicate
+// pixels with SIMD, other ratios gather through a column table, and
+// vertical repeats are row copies. The map is kept in ws.upscaleMap.
+void upscaleStage(const cv::Mat& smallQ, cv::Mat& out, cv::Size size, RetroFilterContext& ws);
+void sharpenStage(cv::Mat& img, RetroFilterContext& ws);
+
+// upscaleStage + sharpenStage in one pass, bit-exact with the pair (1 or
+// 3 channels): the blur only changes pixels next to a block edge, so block
+// interiors are written straight from the small image and rows that repeat
+// the previous one are copied. This is what gbaRetroFilter runs.
+void upscaleSharpenStage(const cv::Mat& smallQ, cv::Mat& out, cv::Size size, RetroFilterContext& ws);
+
+// Index-domain form used for every palette quantizer: `indices` (CV_8U)
+// selects rows of `palette` (Kx3 CV_8U BGR), expanded at the small size
+// into ws.smallQ. Bit-exact with upscaleSharpenStage on that image; every
+// row is replicated from it and only the columns of small pixels whose
+// 3x3 in `indices` holds more than one index are sharpened.
+void upscaleSharpenIndexedStage(const cv::Mat& indices, const cv::Mat& palette, cv::Mat& out, cv::Size size,
+                                RetroFilterContext& ws);
+// indices -> palette colours (CV_8UC3), vectorised for up to 16 colours
+void expandPalette(const cv::Mat& indices, const cv::Mat& palette, cv::Mat& out);